@@ -36,6 +36,13 @@ target_compile_definitions(${SUBMODULE_BINARY} PUBLIC RUNE_VER_MAJOR="${CMAKE_PR
 target_compile_definitions(${SUBMODULE_BINARY} PUBLIC RUNE_VER_MINOR="${CMAKE_PROJECT_VERSION_MINOR}")
 target_compile_definitions(${SUBMODULE_BINARY} PUBLIC RUNE_VER_PATCH="${CMAKE_PROJECT_VERSION_PATCH}")
 
+set(RUNE_MIN_LOG_LEVEL "" CACHE STRING "Least severe log level compiled in (LOG_FATAL..LOG_DEBUG)")
+if (RUNE_MIN_LOG_LEVEL STREQUAL "" AND CMAKE_BUILD_TYPE STREQUAL "Release")
+        target_compile_definitions(${SUBMODULE_BINARY} PUBLIC RUNE_MIN_LOG_LEVEL=LOG_INFO)
+elseif (NOT RUNE_MIN_LOG_LEVEL STREQUAL "")
+        target_compile_definitions(${SUBMODULE_BINARY} PUBLIC RUNE_MIN_LOG_LEVEL=${RUNE_MIN_LOG_LEVEL})
+endif ()
+
 option(ENABLE_PROFILING "Enable profiling")
 if (ENABLE_PROFILING)
         target_compile_definitions(${SUBMODULE_BINARY} PUBLIC RUNE_PROFILING)
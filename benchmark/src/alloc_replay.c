@@ -0,0 +1,392 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Replays an allocation trace recorded with rune_alloc_trace_start against the
+ * engine allocator and the system malloc, and reports throughput, peak RSS
+ * and fragmentation for both. Calls from all threads are replayed in the
+ * order they were recorded on a single thread, and every allocation has its
+ * pages touched so RSS reflects what the game would have used. Each
+ * allocator runs in its own child process so their peak RSS can be told
+ * apart.
+ */
+
+#include <rune/core/alloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define PAGE_SIZE       4096
+#define NO_SLOT         UINT32_MAX
+
+struct replay_op {
+        uint8_t op;
+        uint8_t tag;
+        uint8_t align_shift;
+        uint32_t slot;
+        size_t size;
+};
+
+struct replay {
+        struct replay_op *ops;
+        size_t num_ops;
+        uint32_t num_slots;
+        size_t peak_live;
+        size_t peak_op;
+};
+
+struct slot_map {
+        uint64_t *keys;
+        uint32_t *slots;
+        size_t mask;
+};
+
+struct backend {
+        const char *name;
+        void* (*alloc)(size_t sz, size_t align, int tag);
+        void* (*realloc)(void *ptr, size_t sz);
+        void (*free)(void *ptr);
+        float (*fragmentation)(void);
+};
+
+struct result {
+        double seconds;
+        size_t peak_rss;
+        float heap_frag;
+        int failed;
+};
+
+static void* _rune_alloc(size_t sz, size_t align, int tag) {
+        return rune_alloc_aligned_tagged(sz, align, tag);
+}
+
+static void* _libc_alloc(size_t sz, size_t align, int tag) {
+        void *ret;
+        if (align <= 16)
+                return malloc(sz);
+        if (posix_memalign(&ret, align, sz) != 0)
+                return NULL;
+        return ret;
+}
+
+static const struct backend backends[] = {
+        { "rune", _rune_alloc, rune_realloc, rune_free, rune_alloc_fragmentation },
+        { "malloc", _libc_alloc, realloc, free, NULL },
+};
+
+static inline size_t _hash(uint64_t key, size_t mask) {
+        return (key * 0x9e3779b97f4a7c15ULL >> 17) & mask;
+}
+
+static uint32_t* _map_find(struct slot_map *map, uint64_t key, int insert) {
+        size_t i = _hash(key, map->mask);
+        while (map->keys[i] != 0 && map->keys[i] != key)
+                i = (i + 1) & map->mask;
+        if (map->keys[i] == 0) {
+                if (insert == 0)
+                        return NULL;
+                map->keys[i] = key;
+                map->slots[i] = NO_SLOT;
+        }
+        return &map->slots[i];
+}
+
+static void _emit(struct replay *r, int op, uint32_t slot, size_t sz, const alloc_trace_record_t *rec) {
+        struct replay_op *dst = &r->ops[r->num_ops++];
+        dst->op = op;
+        dst->tag = rec->tag;
+        dst->align_shift = rec->align_shift;
+        dst->slot = slot;
+        dst->size = sz;
+}
+
+/*
+ * Translates recorded pointers into dense slot indices up front, so the timed
+ * replay only indexes an array. Frees of pointers allocated before the trace
+ * started are dropped. Slots are reused, which keeps the slot array as small
+ * as the peak number of live allocations.
+ */
+static int _build_replay(const alloc_trace_record_t *recs, size_t count, struct replay *r) {
+        struct slot_map map;
+        size_t cap = 16;
+        while (cap < count * 2)
+                cap <<= 1;
+        map.keys = calloc(cap, sizeof(uint64_t));
+        map.slots = malloc(cap * sizeof(uint32_t));
+        map.mask = cap - 1;
+
+        uint32_t *free_slots = malloc((count + 1) * sizeof(uint32_t));
+        size_t *sizes = malloc((count + 1) * sizeof(size_t));
+        r->ops = malloc((count * 2 + 1) * sizeof(struct replay_op));
+        if (map.keys == NULL || map.slots == NULL || free_slots == NULL || sizes == NULL || r->ops == NULL)
+                return -1;
+
+        uint32_t num_free = 0;
+        size_t live = 0;
+        uint32_t *slot;
+        uint32_t *old;
+        r->num_ops = 0;
+        r->num_slots = 0;
+        r->peak_live = 0;
+        r->peak_op = 0;
+        for (size_t i = 0; i < count; i++) {
+                const alloc_trace_record_t *rec = &recs[i];
+                if (rec->op == ALLOC_TRACE_FREE) {
+                        slot = _map_find(&map, rec->ptr, 0);
+                        if (slot == NULL || *slot == NO_SLOT)
+                                continue;
+                        _emit(r, ALLOC_TRACE_FREE, *slot, 0, rec);
+                        live -= sizes[*slot];
+                        free_slots[num_free++] = *slot;
+                        *slot = NO_SLOT;
+                        continue;
+                }
+
+                uint32_t id = NO_SLOT;
+                if (rec->op == ALLOC_TRACE_REALLOC) {
+                        old = _map_find(&map, rec->old_ptr, 0);
+                        if (old != NULL && *old != NO_SLOT) {
+                                id = *old;
+                                live -= sizes[id];
+                                *old = NO_SLOT;
+                        }
+                }
+
+                slot = _map_find(&map, rec->ptr, 1);
+                if (*slot != NO_SLOT) {
+                        _emit(r, ALLOC_TRACE_FREE, *slot, 0, rec);
+                        live -= sizes[*slot];
+                        free_slots[num_free++] = *slot;
+                }
+
+                int op = ALLOC_TRACE_REALLOC;
+                if (id == NO_SLOT) {
+                        op = ALLOC_TRACE_ALLOC;
+                        id = num_free > 0 ? free_slots[--num_free] : r->num_slots++;
+                }
+                _emit(r, op, id, rec->size, rec);
+                *slot = id;
+                sizes[id] = rec->size;
+                live += rec->size;
+                if (live > r->peak_live) {
+                        r->peak_live = live;
+                        r->peak_op = r->num_ops - 1;
+                }
+        }
+
+        free(map.keys);
+        free(map.slots);
+        free(free_slots);
+        free(sizes);
+        return 0;
+}
+
+static int _load_trace(const char *path, struct replay *r) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+                fprintf(stderr, "Cannot open %s\n", path);
+                return -1;
+        }
+
+        alloc_trace_header_t header;
+        if (fread(&header, sizeof(header), 1, file) != 1
+                        || header.magic != ALLOC_TRACE_MAGIC
+                        || header.version != ALLOC_TRACE_VERSION
+                        || header.record_size != sizeof(alloc_trace_record_t)) {
+                fprintf(stderr, "%s is not a compatible allocation trace\n", path);
+                fclose(file);
+                return -1;
+        }
+
+        fseek(file, 0, SEEK_END);
+        size_t count = (ftell(file) - sizeof(header)) / sizeof(alloc_trace_record_t);
+        fseek(file, sizeof(header), SEEK_SET);
+        alloc_trace_record_t *recs = malloc(count * sizeof(alloc_trace_record_t) + 1);
+        if (recs == NULL || fread(recs, sizeof(alloc_trace_record_t), count, file) != count) {
+                fprintf(stderr, "Cannot read %zu records from %s\n", count, path);
+                free(recs);
+                fclose(file);
+                return -1;
+        }
+        fclose(file);
+
+        int ret = _build_replay(recs, count, r);
+        free(recs);
+        if (ret != 0)
+                fprintf(stderr, "Out of memory while preparing replay\n");
+        return ret;
+}
+
+static inline void _touch(void *ptr, size_t sz) {
+        volatile char *p = ptr;
+        for (size_t off = 0; off < sz; off += PAGE_SIZE)
+                p[off] = 1;
+}
+
+static size_t _current_rss(void) {
+        FILE *file = fopen("/proc/self/statm", "r");
+        if (file == NULL)
+                return 0;
+
+        size_t pages = 0;
+        size_t resident = 0;
+        if (fscanf(file, "%zu %zu", &pages, &resident) != 2)
+                resident = 0;
+        fclose(file);
+        return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void _run(const struct replay *r, const struct backend *b, int iterations, struct result *res) {
+        void **slots = calloc(r->num_slots + 1, sizeof(void*));
+        struct timespec start;
+        struct timespec stop;
+        void *ptr;
+        memset(res, 0, sizeof(*res));
+        res->heap_frag = -1.0f;
+        if (slots == NULL) {
+                res->failed = 1;
+                return;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int it = 0; it < iterations; it++) {
+                for (size_t i = 0; i < r->num_ops; i++) {
+                        const struct replay_op *op = &r->ops[i];
+                        switch (op->op) {
+                        case ALLOC_TRACE_ALLOC:
+                                ptr = b->alloc(op->size, (size_t)1 << op->align_shift, op->tag);
+                                break;
+                        case ALLOC_TRACE_REALLOC:
+                                ptr = b->realloc(slots[op->slot], op->size);
+                                break;
+                        default:
+                                b->free(slots[op->slot]);
+                                slots[op->slot] = NULL;
+                                continue;
+                        }
+
+                        if (ptr == NULL) {
+                                res->failed = 1;
+                                continue;
+                        }
+                        _touch(ptr, op->size);
+                        slots[op->slot] = ptr;
+                        if (i == r->peak_op && it == iterations - 1) {
+                                res->peak_rss = _current_rss();
+                                if (b->fragmentation != NULL)
+                                        res->heap_frag = b->fragmentation();
+                        }
+                }
+
+                for (uint32_t i = 0; i < r->num_slots; i++) {
+                        if (slots[i] != NULL)
+                                b->free(slots[i]);
+                        slots[i] = NULL;
+                }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        res->seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+        free(slots);
+}
+
+static int _run_child(const struct replay *r, const struct backend *b, int iterations,
+                      struct result *res, long *max_rss) {
+        int fds[2];
+        if (pipe(fds) != 0)
+                return -1;
+
+        pid_t pid = fork();
+        if (pid < 0)
+                return -1;
+        if (pid == 0) {
+                close(fds[0]);
+                _run(r, b, iterations, res);
+                if (write(fds[1], res, sizeof(*res)) != sizeof(*res))
+                        _exit(1);
+                _exit(0);
+        }
+
+        close(fds[1]);
+        ssize_t n = read(fds[0], res, sizeof(*res));
+        close(fds[0]);
+
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) < 0 || n != sizeof(*res))
+                return -1;
+        *max_rss = usage.ru_maxrss;
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        if (argc < 2) {
+                fprintf(stderr, "Usage: %s <trace> [iterations]\n", argv[0]);
+                return 1;
+        }
+
+        int iterations = 5;
+        if (argc > 2)
+                iterations = atoi(argv[2]);
+        if (iterations < 1)
+                iterations = 1;
+
+        struct replay replay;
+        if (_load_trace(argv[1], &replay) != 0)
+                return 1;
+
+        size_t base_rss = _current_rss();
+        printf("%zu operations, %u live slots, peak live %zu KiB, replayed %d times\n",
+                        replay.num_ops, replay.num_slots, replay.peak_live >> 10, iterations);
+        printf("RSS figures include %zu KiB used by the replay tool\n\n", base_rss >> 10);
+        printf("%-8s %14s %14s %14s %12s %10s\n", "", "ops/s", "max RSS KiB",
+                        "RSS at peak", "overhead", "heap frag");
+
+        struct result res;
+        long max_rss;
+        for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+                if (_run_child(&replay, &backends[i], iterations, &res, &max_rss) != 0) {
+                        printf("%-8s replay failed\n", backends[i].name);
+                        continue;
+                }
+
+                float overhead = 0.0f;
+                size_t used = res.peak_rss > base_rss ? res.peak_rss - base_rss : 0;
+                if (used > replay.peak_live)
+                        overhead = 1.0f - (float)replay.peak_live / (float)used;
+                printf("%-8s %14.0f %14ld %14zu %11.1f%%", backends[i].name,
+                                replay.num_ops * iterations / res.seconds, max_rss,
+                                res.peak_rss >> 10, overhead * 100.0f);
+                if (res.heap_frag >= 0.0f)
+                        printf(" %9.1f%%", res.heap_frag * 100.0f);
+                else
+                        printf(" %10s", "-");
+                if (res.failed)
+                        printf("  (some allocations failed)");
+                printf("\n");
+        }
+
+        free(replay.ops);
+        return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Stress tests and measures the queues in rune/util/queue.h. Every value
+ * pushed carries its producer in the top bits and a sequence number in the
+ * rest. Consumers check that each producer's values arrive in order and
+ * without gaps as far as they can see them, and the sum and count of
+ * everything popped must match what was pushed. Throughput is reported as
+ * pushes plus pops per second. Full and empty queues are retried with a
+ * yield, so the numbers stay meaningful with more threads than CPUs.
+ */
+
+#include <rune/util/queue.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAPACITY        1024
+#define PRODUCER_SHIFT  40
+#define SEQ_MASK        (((uint64_t)1 << PRODUCER_SHIFT) - 1)
+#define MAX_THREADS     64
+
+struct mpsc_item {
+        mpsc_node_t node;
+        uint64_t value;
+};
+
+struct bench {
+        size_t ops;
+        int producers;
+        int consumers;
+        pthread_barrier_t start;
+        spsc_queue_t spsc;
+        mpsc_queue_t mpsc;
+        mpmc_queue_t mpmc;
+        struct mpsc_item *items;
+        atomic_size_t popped;
+        atomic_uint_least64_t sum;
+        atomic_int errors;
+};
+
+struct worker {
+        struct bench *b;
+        int index;
+};
+
+static double _seconds(const struct timespec *start, const struct timespec *stop) {
+        return (stop->tv_sec - start->tv_sec) + (stop->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static inline uint64_t _value(int producer, size_t seq) {
+        return ((uint64_t)producer << PRODUCER_SHIFT) | seq;
+}
+
+static uint64_t _expected_sum(const struct bench *b) {
+        uint64_t sum = 0;
+        for (int p = 0; p < b->producers; p++)
+                sum += ((uint64_t)p << PRODUCER_SHIFT) * b->ops + (uint64_t)b->ops * (b->ops - 1) / 2;
+        return sum;
+}
+
+static void _check_order(struct bench *b, uint64_t *last, uint64_t value, int strict) {
+        int producer = value >> PRODUCER_SHIFT;
+        uint64_t seq = value & SEQ_MASK;
+        if (producer >= b->producers) {
+                atomic_fetch_add(&b->errors, 1);
+                return;
+        }
+        if (last[producer] != UINT64_MAX && (strict ? seq != last[producer] + 1 : seq <= last[producer]))
+                atomic_fetch_add(&b->errors, 1);
+        last[producer] = seq;
+}
+
+static void* _spsc_producer(void *data) {
+        struct worker *w = data;
+        struct bench *b = w->b;
+        pthread_barrier_wait(&b->start);
+        for (size_t i = 0; i < b->ops; i++) {
+                uint64_t value = _value(0, i);
+                while (spsc_queue_push(&b->spsc, &value) != 0)
+                        sched_yield();
+        }
+        return NULL;
+}
+
+static void* _spsc_consumer(void *data) {
+        struct worker *w = data;
+        struct bench *b = w->b;
+        uint64_t last = UINT64_MAX;
+        uint64_t sum = 0;
+        uint64_t value;
+        pthread_barrier_wait(&b->start);
+        for (size_t i = 0; i < b->ops; i++) {
+                while (spsc_queue_pop(&b->spsc, &value) != 0)
+                        sched_yield();
+                _check_order(b, &last, value, 1);
+                sum += value;
+        }
+        atomic_fetch_add(&b->sum, sum);
+        atomic_fetch_add(&b->popped, b->ops);
+        return NULL;
+}
+
+static void* _mpsc_producer(void *data) {
+        struct worker *w = data;
+        struct bench *b = w->b;
+        struct mpsc_item *items = &b->items[w->index * b->ops];
+        pthread_barrier_wait(&b->start);
+        for (size_t i = 0; i < b->ops; i++) {
+                items[i].value = _value(w->index, i);
+                mpsc_queue_push(&b->mpsc, &items[i].node);
+        }
+        return NULL;
+}
+
+static void* _mpsc_consumer(void *data) {
+        struct worker *w = data;
+        struct bench *b = w->b;
+        uint64_t last[MAX_THREADS];
+        uint64_t sum = 0;
+        size_t total = b->ops * b->producers;
+        mpsc_node_t *node;
+        memset(last, 0xff, sizeof(last));
+        pthread_barrier_wait(&b->start);
+        for (size_t i = 0; i < total; i++) {
+                while ((node = mpsc_queue_pop(&b->mpsc)) == NULL)
+                        sched_yield();
+                uint64_t value = mpsc_entry(node, struct mpsc_item, node)->value;
+                _check_order(b, last, value, 1);
+                sum += value;
+        }
+        atomic_fetch_add(&b->sum, sum);
+        atomic_fetch_add(&b->popped, total);
+        return NULL;
+}
+
+static void* _mpmc_producer(void *data) {
+        struct worker *w = data;
+        struct bench *b = w->b;
+        pthread_barrier_wait(&b->start);
+        for (size_t i = 0; i < b->ops; i++) {
+                uint64_t value = _value(w->index, i);
+                while (mpmc_queue_push(&b->mpmc, &value) != 0)
+                        sched_yield();
+        }
+        return NULL;
+}
+
+static void* _mpmc_consumer(void *data) {
+        struct worker *w = data;
+        struct bench *b = w->b;
+        uint64_t last[MAX_THREADS];
+        uint64_t sum = 0;
+        size_t total = b->ops * b->producers;
+        uint64_t value;
+        memset(last, 0xff, sizeof(last));
+        pthread_barrier_wait(&b->start);
+        while (atomic_load_explicit(&b->popped, memory_order_relaxed) < total) {
+                if (mpmc_queue_pop(&b->mpmc, &value) != 0) {
+                        sched_yield();
+                        continue;
+                }
+                _check_order(b, last, value, 0);
+                sum += value;
+                atomic_fetch_add_explicit(&b->popped, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add(&b->sum, sum);
+        return NULL;
+}
+
+static int _run(const char *name, struct bench *b, void* (*producer)(void*), void* (*consumer)(void*)) {
+        pthread_t threads[MAX_THREADS * 2];
+        struct worker workers[MAX_THREADS * 2];
+        int count = b->producers + b->consumers;
+        struct timespec start;
+        struct timespec stop;
+
+        atomic_store(&b->popped, 0);
+        atomic_store(&b->sum, 0);
+        atomic_store(&b->errors, 0);
+        pthread_barrier_init(&b->start, NULL, count + 1);
+        for (int i = 0; i < count; i++) {
+                workers[i].b = b;
+                workers[i].index = i < b->producers ? i : i - b->producers;
+                if (pthread_create(&threads[i], NULL, i < b->producers ? producer : consumer, &workers[i]) != 0) {
+                        fprintf(stderr, "Cannot create thread\n");
+                        exit(1);
+                }
+        }
+
+        pthread_barrier_wait(&b->start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < count; i++)
+                pthread_join(threads[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        pthread_barrier_destroy(&b->start);
+
+        size_t total = b->ops * b->producers;
+        int failed = atomic_load(&b->errors) != 0 || atomic_load(&b->popped) != total
+                || atomic_load(&b->sum) != _expected_sum(b);
+        printf("%-6s %4d %4d %16.0f   %s\n", name, b->producers, b->consumers,
+                        total * 2 / _seconds(&start, &stop), failed ? "FAILED" : "ok");
+        return failed;
+}
+
+int main(int argc, char **argv) {
+        struct bench b;
+        b.ops = 1000000;
+        if (argc > 1)
+                b.ops = strtoull(argv[1], NULL, 10);
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc > 2)
+                threads = atoi(argv[2]);
+        if (b.ops == 0 || b.ops > SEQ_MASK) {
+                fprintf(stderr, "Usage: %s [ops per producer] [threads]\n", argv[0]);
+                return 1;
+        }
+        if (threads < 2)
+                threads = 2;
+        if (threads > MAX_THREADS)
+                threads = MAX_THREADS;
+
+        void *spsc_buf = malloc(CAPACITY * sizeof(uint64_t));
+        void *mpmc_buf = aligned_alloc(QUEUE_CACHE_LINE, MPMC_QUEUE_BUFFER_SIZE(CAPACITY, sizeof(uint64_t)));
+        b.items = malloc(b.ops * (threads - 1) * sizeof(struct mpsc_item));
+        if (spsc_buf == NULL || mpmc_buf == NULL || b.items == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+        }
+
+        printf("%zu pushes per producer, queue capacity %d\n\n", b.ops, CAPACITY);
+        printf("%-6s %4s %4s %16s   %s\n", "queue", "prod", "cons", "ops/s", "check");
+        int failed = 0;
+
+        spsc_queue_init(&b.spsc, spsc_buf, CAPACITY, sizeof(uint64_t));
+        b.producers = 1;
+        b.consumers = 1;
+        failed |= _run("spsc", &b, _spsc_producer, _spsc_consumer);
+
+        mpsc_queue_init(&b.mpsc);
+        b.producers = threads - 1;
+        b.consumers = 1;
+        failed |= _run("mpsc", &b, _mpsc_producer, _mpsc_consumer);
+
+        for (int producers = 1; producers < threads; producers *= 2) {
+                mpmc_queue_init(&b.mpmc, mpmc_buf, CAPACITY, sizeof(uint64_t));
+                b.producers = producers;
+                b.consumers = threads - producers;
+                failed |= _run("mpmc", &b, _mpmc_producer, _mpmc_consumer);
+        }
+
+        free(b.items);
+        free(mpmc_buf);
+        free(spsc_buf);
+        return failed;
+}
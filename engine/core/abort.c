@@ -70,6 +70,7 @@ void _stack_trace(void) {
 #endif
 
 NORET void rune_abort(void) {
+        rune_log_flush();
         log_output(LOG_INFO, "Abort called, printing stack trace");
         _stack_trace();
         rune_exit();
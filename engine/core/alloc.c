@@ -22,114 +22,959 @@
 #include <rune/core/alloc.h>
 #include <rune/core/logging.h>
 #include <rune/core/profiling.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-// TODO: implement block coalescing so we can reuse freed blocks
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
-#define DEADBLOCK       ((void*)0xDEADBEEF)
+#define SLAB_SHIFT      16
+#define SLAB_SIZE       ((size_t)1 << SLAB_SHIFT)
+#define ARENA_SHIFT     28
+#define ARENA_SIZE      ((size_t)1 << ARENA_SHIFT)
+#define MAX_ARENAS      64
+#define PAGE_SIZE       4096
+#define HUGE_PAGE_SIZE  ((size_t)2 << 20)
+#define CACHE_LINE      64
+
+#define MIN_OBJ_SIZE    16
+#define MAX_SMALL_SIZE  2048
+#define NUM_CLASSES     24
+#define MAG_SIZE        32
+#define MAG_BYTES       8192
+
+#define BLOCK_HDR_SIZE  ((sizeof(mem_block_t) + MIN_OBJ_SIZE - 1) & ~(MIN_OBJ_SIZE - 1))
+#define MIN_SPLIT_SIZE  64
+#define DIRECT_SIZE     (ARENA_SIZE / 8)
+#define DECOMMIT_SIZE   ((size_t)64 << 10)
+#define TRACE_BUF_LEN   4096
+
+#define SL_BITS         4
+#define SL_COUNT        (1 << SL_BITS)
+#define FL_SHIFT        (SL_BITS + 4)
+#define FL_COUNT        (ARENA_SHIFT - FL_SHIFT + 1)
+#define SMALL_BLOCK     ((size_t)1 << FL_SHIFT)
+
+#define ARENA_SLAB      0
+#define ARENA_HEAP      1
+
+/*
+ * Small allocations are served from 64K slabs, each slab holding objects of a
+ * single size class. Slabs are carved out of large mmap-reserved arenas and
+ * are aligned to their own size, so the owning slab of any small pointer is
+ * found by masking off the low bits.
+ *
+ * Anything larger than MAX_SMALL_SIZE comes from heap arenas managed as a
+ * two-level segregated fit (TLSF) allocator. Every heap block carries its
+ * mem_block_t directly in front of the returned pointer, along with a link to
+ * its physical predecessor, so free blocks can be split on allocation and
+ * coalesced with both neighbors on free in constant time. Requests too big
+ * for an arena are mapped directly and tracked on the first_block list.
+ *
+ * Arenas are aligned to the huge page size, so when huge pages are enabled
+ * they can be backed entirely by 2M pages. Decommitting in such an arena only
+ * ever releases whole huge pages, since punching 4K holes would split them.
+ *
+ * Each thread keeps a magazine of free objects per size class, so most small
+ * allocations and frees never touch shared state. Magazines are refilled
+ * from and flushed back to the slabs in batches, under a per-class lock.
+ *
+ * Every allocation is charged to a tag. Slabs keep one tag byte per object
+ * after their header and heap blocks keep it in mem_block_t, so frees can be
+ * credited back without the caller naming the tag again.
+ */
+
+struct size_class {
+        size_t sz;
+        int mag_size;
+        list_head_t partial;
+        pthread_mutex_t lock;
+};
+
+struct magazine {
+        int count;
+        void *objs[MAG_SIZE];
+};
+
+struct thread_cache {
+        int gen;
+        struct magazine mags[NUM_CLASSES];
+};
+
+struct slab {
+        mem_block_t block;
+        struct size_class *class;
+        void *free_objs;
+        uintptr_t start;
+        uintptr_t fresh;
+        uintptr_t end;
+        uint32_t num_objs;
+        uint32_t num_used;
+        uint8_t tags[];
+};
+
+struct arena {
+        int kind;
+        void *raw;
+        size_t raw_sz;
+        int huge;
+        size_t page_size;
+        uintptr_t base;
+        size_t used;
+        void *free_slabs;
+};
+
+struct frame_overflow {
+        struct frame_overflow *next;
+        _Alignas(MIN_OBJ_SIZE) uint8_t data[];
+};
+
+struct frame_arena {
+        uintptr_t base;
+        size_t sz;
+        atomic_size_t used;
+        _Atomic(struct frame_overflow*) overflow;
+};
+
+struct tag_stats {
+        _Alignas(CACHE_LINE) atomic_size_t current;
+        atomic_size_t peak;
+        atomic_size_t count;
+        atomic_size_t total;
+        atomic_size_t budget;
+        atomic_int over_budget;
+        const char *name;
+};
+
+struct heap {
+        uint32_t fl_bitmap;
+        uint32_t sl_bitmap[FL_COUNT];
+        list_head_t free_lists[FL_COUNT][SL_COUNT];
+        size_t free_bytes;
+        size_t used_bytes;
+};
+
+static const size_t class_sizes[NUM_CLASSES] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+static uint8_t class_index[MAX_SMALL_SIZE / MIN_OBJ_SIZE + 1];
+static struct size_class classes[NUM_CLASSES];
+static struct arena arenas[MAX_ARENAS];
+static atomic_int num_arenas = 0;
+static struct heap heap;
+static struct frame_arena *frame_arenas = NULL;
+static _Atomic(struct frame_arena*) cur_frame = NULL;
+static uint8_t num_frames = 0;
+static atomic_int initialized = 0;
+static atomic_int hugepage_mode = ALLOC_HUGEPAGES_OFF;
+static atomic_int hugepage_warned = 0;
+static atomic_int alloc_gen = 1;
+
+static struct tag_stats tag_stats[MEM_TAG_MAX] = {
+        [MEM_TAG_GENERAL] = { .name = "general" },
+        [MEM_TAG_RENDER] = { .name = "render" },
+        [MEM_TAG_MOD] = { .name = "mod" },
+        [MEM_TAG_AUDIO] = { .name = "audio" },
+        [MEM_TAG_THREAD] = { .name = "thread" },
+        [MEM_TAG_UI] = { .name = "ui" },
+        [MEM_TAG_LOG] = { .name = "log" },
+        [MEM_TAG_FRAME] = { .name = "frame" },
+};
+static atomic_int num_tags = MEM_TAG_USER;
+static atomic_uint dump_interval = 0;
+static time_t last_dump = 0;
+
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t block_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tag_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE *trace_file = NULL;
+static atomic_int tracing = 0;
+static struct timespec trace_start;
+static alloc_trace_record_t trace_buf[TRACE_BUF_LEN];
+static int trace_count = 0;
+static atomic_uint trace_threads = 0;
+static _Thread_local uint32_t trace_thread = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct thread_cache tcache;
 
 static mem_block_t first_block;
 
-static mem_block_t* _find_free_block(size_t sz) {
-        list_head_t *temp = &first_block.list;
-        mem_block_t *block;
-        while (temp != NULL) {
-                block = (mem_block_t*)((void*)temp - offsetof(mem_block_t, list));
-                if (block->sz == sz && block->free == 1)
-                        return block;
-                temp = temp->next;
+#ifndef _WIN32
+static void* _map_pages(size_t sz, int flags) {
+        void *ret = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        if (ret == MAP_FAILED)
+                return NULL;
+        return ret;
+}
+#endif
+
+static void* _map_region(size_t sz, int *huge) {
+        *huge = ALLOC_HUGEPAGES_OFF;
+#ifdef _WIN32
+        return VirtualAlloc(NULL, sz, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        int mode = atomic_load_explicit(&hugepage_mode, memory_order_relaxed);
+        void *ret;
+#ifdef MAP_HUGETLB
+        if (mode == ALLOC_HUGEPAGES_EXPLICIT && (sz & (HUGE_PAGE_SIZE - 1)) == 0) {
+                ret = _map_pages(sz, MAP_HUGETLB);
+                if (ret != NULL) {
+                        *huge = ALLOC_HUGEPAGES_EXPLICIT;
+                        return ret;
+                }
+                if (atomic_exchange(&hugepage_warned, 1) == 0)
+                        log_output(LOG_WARN, "Cannot reserve %zu bytes of huge pages, falling back to transparent huge pages", sz);
         }
-        return NULL;
+#endif
+
+        ret = _map_pages(sz, MAP_NORESERVE);
+#ifdef MADV_HUGEPAGE
+        if (ret != NULL && mode != ALLOC_HUGEPAGES_OFF && sz >= HUGE_PAGE_SIZE) {
+                if (madvise(ret, sz, MADV_HUGEPAGE) == 0)
+                        *huge = ALLOC_HUGEPAGES_TRANSPARENT;
+                else if (atomic_exchange(&hugepage_warned, 1) == 0)
+                        log_output(LOG_WARN, "Transparent huge pages are unavailable, using normal pages");
+        }
+#endif
+        return ret;
+#endif
 }
 
-static mem_block_t* _find_block(void *ptr) {
-        list_head_t *temp = &first_block.list;
-        mem_block_t *block;
-        while (temp != NULL) {
-                block = (mem_block_t*)((void*)temp - offsetof(mem_block_t, list));
-                if (block->ptr == ptr)
-                        return block;
-                temp = temp->next;
+static void _unmap_region(void *ptr, size_t sz) {
+#ifdef _WIN32
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, sz);
+#endif
+}
+
+static void _decommit(void *ptr, size_t sz, size_t page_size) {
+        uintptr_t start = ((uintptr_t)ptr + page_size - 1) & ~(uintptr_t)(page_size - 1);
+        uintptr_t end = ((uintptr_t)ptr + sz) & ~(uintptr_t)(page_size - 1);
+        if (end <= start)
+                return;
+#ifdef _WIN32
+        VirtualAlloc((void*)start, end - start, MEM_RESET, PAGE_READWRITE);
+#else
+        madvise((void*)start, end - start, MADV_DONTNEED);
+#endif
+}
+
+static void _init_classes(void) {
+        pthread_mutex_lock(&init_lock);
+        if (atomic_load(&initialized) == 1) {
+                pthread_mutex_unlock(&init_lock);
+                return;
+        }
+
+        int cur = 0;
+        for (size_t i = 0; i <= MAX_SMALL_SIZE / MIN_OBJ_SIZE; i++) {
+                while (class_sizes[cur] < i * MIN_OBJ_SIZE)
+                        cur++;
+                class_index[i] = cur;
+        }
+
+        for (int i = 0; i < NUM_CLASSES; i++) {
+                classes[i].sz = class_sizes[i];
+                classes[i].mag_size = MAG_BYTES / class_sizes[i];
+                if (classes[i].mag_size > MAG_SIZE)
+                        classes[i].mag_size = MAG_SIZE;
+                classes[i].partial.next = NULL;
+                classes[i].partial.prev = NULL;
+                pthread_mutex_init(&classes[i].lock, NULL);
+        }
+        memset(&heap, 0, sizeof(heap));
+        first_block.list.next = NULL;
+        first_block.list.prev = NULL;
+        atomic_store(&initialized, 1);
+        pthread_mutex_unlock(&init_lock);
+}
+
+static struct arena* _new_arena(int kind) {
+        int count = atomic_load(&num_arenas);
+        if (count == MAX_ARENAS)
+                return NULL;
+
+        int huge;
+        size_t raw_sz = ARENA_SIZE + HUGE_PAGE_SIZE;
+        void *raw = _map_region(raw_sz, &huge);
+        if (raw == NULL) {
+                log_output(LOG_ERROR, "Cannot reserve arena of size %zu", raw_sz);
+                return NULL;
+        }
+
+        struct arena *arena = &arenas[count];
+        arena->kind = kind;
+        arena->raw = raw;
+        arena->raw_sz = raw_sz;
+        arena->huge = huge;
+        arena->page_size = huge != ALLOC_HUGEPAGES_OFF ? HUGE_PAGE_SIZE : PAGE_SIZE;
+        arena->base = ((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        arena->used = 0;
+        arena->free_slabs = NULL;
+        atomic_store_explicit(&num_arenas, count + 1, memory_order_release);
+        RLOG_DEBUG("Reserved arena of size %zu", raw_sz);
+        return arena;
+}
+
+static struct arena* _find_arena(const void *ptr) {
+        uintptr_t addr = (uintptr_t)ptr;
+        int count = atomic_load_explicit(&num_arenas, memory_order_acquire);
+        for (int i = 0; i < count; i++) {
+                if (addr >= arenas[i].base && addr < arenas[i].base + ARENA_SIZE)
+                        return &arenas[i];
         }
         return NULL;
 }
 
-static mem_block_t* _alloc_block(size_t sz) {
-        RUNE_PROFILE_SCOPE("Block allocation");
-        if (first_block.ptr == NULL) {
-                first_block.ptr = DEADBLOCK;
-                first_block.sz = 0;
+static void* _arena_get_slab(void) {
+        struct arena *arena;
+        void *ret = NULL;
+        pthread_mutex_lock(&arena_lock);
+        for (int i = 0; i < atomic_load(&num_arenas); i++) {
+                arena = &arenas[i];
+                if (arena->kind != ARENA_SLAB)
+                        continue;
+                if (arena->free_slabs != NULL) {
+                        ret = arena->free_slabs;
+                        arena->free_slabs = *(void**)ret;
+                        break;
+                }
+                if (arena->used + SLAB_SIZE <= ARENA_SIZE) {
+                        ret = (void*)(arena->base + arena->used);
+                        arena->used += SLAB_SIZE;
+                        break;
+                }
+        }
+
+        if (ret == NULL) {
+                arena = _new_arena(ARENA_SLAB);
+                if (arena != NULL) {
+                        arena->used = SLAB_SIZE;
+                        ret = (void*)arena->base;
+                }
+        }
+        pthread_mutex_unlock(&arena_lock);
+        return ret;
+}
+
+static void _arena_put_slab(struct arena *arena, struct slab *slab) {
+        _decommit((void*)((uintptr_t)slab + PAGE_SIZE), SLAB_SIZE - PAGE_SIZE, arena->page_size);
+        pthread_mutex_lock(&arena_lock);
+        *(void**)slab = arena->free_slabs;
+        arena->free_slabs = slab;
+        pthread_mutex_unlock(&arena_lock);
+}
+
+static struct slab* _new_slab(struct size_class *class) {
+        struct slab *slab = _arena_get_slab();
+        if (slab == NULL)
+                return NULL;
+
+        uint32_t num_objs = (SLAB_SIZE - sizeof(struct slab) - CACHE_LINE + 1) / (class->sz + 1);
+        uintptr_t start = (uintptr_t)slab->tags + num_objs;
+        start = (start + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1);
+        slab->block.ptr = slab;
+        slab->block.sz = SLAB_SIZE;
+        slab->block.free = 0;
+        slab->block.prev_phys = NULL;
+        slab->class = class;
+        slab->free_objs = NULL;
+        slab->num_objs = num_objs;
+        slab->num_used = 0;
+        slab->start = start;
+        slab->fresh = start;
+        slab->end = start + slab->num_objs * class->sz;
+        RLOG_DEBUG("Alloc'd slab for size class %zu", class->sz);
+        return slab;
+}
+
+static void* _slab_alloc(struct size_class *class) {
+        struct slab *slab;
+        if (class->partial.next == NULL) {
+                slab = _new_slab(class);
+                if (slab == NULL)
+                        return NULL;
+                list_insert(&slab->block.list, &class->partial);
+        } else {
+                slab = (struct slab*)((void*)class->partial.next - offsetof(mem_block_t, list));
         }
 
-        mem_block_t *ret = _find_free_block(sz);
+        void *ret = slab->free_objs;
         if (ret != NULL) {
-                ret->free = 0;
-                RUNE_PROFILE_END();
-                return ret->ptr;
+                slab->free_objs = *(void**)ret;
+        } else {
+                ret = (void*)slab->fresh;
+                slab->fresh += class->sz;
         }
 
-        ret = malloc(sizeof(mem_block_t));
-        if (ret == NULL) {
+        slab->num_used++;
+        if (slab->num_used == slab->num_objs)
+                list_del(&slab->block.list);
+        return ret;
+}
+
+static void _slab_free(struct arena *arena, struct slab *slab, void *ptr) {
+        struct size_class *class = slab->class;
+        if (slab->num_used == slab->num_objs)
+                list_insert(&slab->block.list, &class->partial);
+
+        *(void**)ptr = slab->free_objs;
+        slab->free_objs = ptr;
+        slab->num_used--;
+        if (slab->num_used > 0)
+                return;
+
+        if (class->partial.next == &slab->block.list && slab->block.list.next == NULL)
+                return;
+        list_del(&slab->block.list);
+        slab->block.free = 1;
+        _arena_put_slab(arena, slab);
+}
+
+static void _mag_flush(struct magazine *mag, struct size_class *class, int count) {
+        struct slab *slab;
+        void *obj;
+        pthread_mutex_lock(&class->lock);
+        for (int i = 0; i < count; i++) {
+                obj = mag->objs[i];
+                slab = (struct slab*)((uintptr_t)obj & ~(SLAB_SIZE - 1));
+                _slab_free(_find_arena(obj), slab, obj);
+        }
+        pthread_mutex_unlock(&class->lock);
+
+        mag->count -= count;
+        memmove(mag->objs, &mag->objs[count], mag->count * sizeof(void*));
+}
+
+static int _mag_refill(struct magazine *mag, struct size_class *class) {
+        void *obj;
+        pthread_mutex_lock(&class->lock);
+        while (mag->count < class->mag_size / 2 + 1) {
+                obj = _slab_alloc(class);
+                if (obj == NULL)
+                        break;
+                mag->objs[mag->count++] = obj;
+        }
+        pthread_mutex_unlock(&class->lock);
+        return mag->count;
+}
+
+static void _tcache_destroy(void *arg) {
+        struct thread_cache *cache = (struct thread_cache*)arg;
+        if (cache->gen != atomic_load(&alloc_gen))
+                return;
+
+        for (int i = 0; i < NUM_CLASSES; i++) {
+                if (cache->mags[i].count > 0)
+                        _mag_flush(&cache->mags[i], &classes[i], cache->mags[i].count);
+        }
+        cache->gen = 0;
+}
+
+static void _tcache_create_key(void) {
+        pthread_key_create(&tcache_key, _tcache_destroy);
+}
+
+static void _tcache_init(void) {
+        pthread_once(&tcache_once, _tcache_create_key);
+        pthread_setspecific(tcache_key, &tcache);
+        for (int i = 0; i < NUM_CLASSES; i++)
+                tcache.mags[i].count = 0;
+        tcache.gen = atomic_load(&alloc_gen);
+}
+
+static inline struct magazine* _get_magazine(int index) {
+        if (tcache.gen != atomic_load_explicit(&alloc_gen, memory_order_relaxed))
+                _tcache_init();
+        return &tcache.mags[index];
+}
+
+static inline void _tag_grow(int tag, size_t sz) {
+        struct tag_stats *stats = &tag_stats[tag];
+        size_t cur = atomic_fetch_add_explicit(&stats->current, sz, memory_order_relaxed) + sz;
+        size_t peak = atomic_load_explicit(&stats->peak, memory_order_relaxed);
+        while (cur > peak && !atomic_compare_exchange_weak_explicit(&stats->peak, &peak, cur,
+                                memory_order_relaxed, memory_order_relaxed))
+                ;
+}
+
+static inline void _tag_charge(int tag, size_t sz) {
+        _tag_grow(tag, sz);
+        atomic_fetch_add_explicit(&tag_stats[tag].count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&tag_stats[tag].total, 1, memory_order_relaxed);
+}
+
+static inline void _tag_credit(int tag, size_t sz) {
+        atomic_fetch_sub_explicit(&tag_stats[tag].current, sz, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&tag_stats[tag].count, 1, memory_order_relaxed);
+}
+
+static inline uint8_t* _slab_tag(struct slab *slab, void *ptr) {
+        return &slab->tags[((uintptr_t)ptr - slab->start) / slab->class->sz];
+}
+
+static void* _small_alloc(int index, int tag) {
+        struct magazine *mag = _get_magazine(index);
+        if (mag->count == 0 && _mag_refill(mag, &classes[index]) == 0)
+                return NULL;
+
+        void *ret = mag->objs[--mag->count];
+        struct slab *slab = (struct slab*)((uintptr_t)ret & ~(SLAB_SIZE - 1));
+        *_slab_tag(slab, ret) = tag;
+        _tag_charge(tag, classes[index].sz);
+        return ret;
+}
+
+static void _small_free(struct slab *slab, void *ptr) {
+        struct size_class *class = slab->class;
+        _tag_credit(*_slab_tag(slab, ptr), class->sz);
+        struct magazine *mag = _get_magazine(class - classes);
+        if (mag->count == class->mag_size)
+                _mag_flush(mag, class, mag->count / 2);
+        mag->objs[mag->count++] = ptr;
+}
+
+static inline int _fls(size_t x) {
+        return 63 - __builtin_clzll((unsigned long long)x);
+}
+
+static inline void _map_insert(size_t sz, int *fl, int *sl) {
+        if (sz < SMALL_BLOCK) {
+                *fl = 0;
+                *sl = sz / (SMALL_BLOCK / SL_COUNT);
+                return;
+        }
+
+        int bit = _fls(sz);
+        *sl = (sz >> (bit - SL_BITS)) ^ SL_COUNT;
+        *fl = bit - FL_SHIFT + 1;
+}
+
+static inline void _map_search(size_t sz, int *fl, int *sl) {
+        if (sz >= SMALL_BLOCK)
+                sz += ((size_t)1 << (_fls(sz) - SL_BITS)) - 1;
+        _map_insert(sz, fl, sl);
+}
+
+static inline mem_block_t* _next_phys(mem_block_t *block) {
+        return (mem_block_t*)((uintptr_t)block->ptr + block->sz);
+}
+
+static void _heap_insert(mem_block_t *block) {
+        int fl;
+        int sl;
+        _map_insert(block->sz, &fl, &sl);
+        list_insert(&block->list, &heap.free_lists[fl][sl]);
+        heap.fl_bitmap |= 1U << fl;
+        heap.sl_bitmap[fl] |= 1U << sl;
+        heap.free_bytes += block->sz;
+        block->free = 1;
+}
+
+static void _heap_remove(mem_block_t *block) {
+        int fl;
+        int sl;
+        _map_insert(block->sz, &fl, &sl);
+        list_del(&block->list);
+        if (heap.free_lists[fl][sl].next == NULL) {
+                heap.sl_bitmap[fl] &= ~(1U << sl);
+                if (heap.sl_bitmap[fl] == 0)
+                        heap.fl_bitmap &= ~(1U << fl);
+        }
+        heap.free_bytes -= block->sz;
+        block->free = 0;
+}
+
+static mem_block_t* _heap_find(size_t sz) {
+        int fl;
+        int sl;
+        _map_search(sz, &fl, &sl);
+        if (fl >= FL_COUNT)
+                return NULL;
+
+        uint32_t sl_map = heap.sl_bitmap[fl] & (~0U << sl);
+        if (sl_map == 0) {
+                uint32_t fl_map = heap.fl_bitmap & (~0U << (fl + 1));
+                if (fl_map == 0)
+                        return NULL;
+                fl = __builtin_ctz(fl_map);
+                sl_map = heap.sl_bitmap[fl];
+        }
+        sl = __builtin_ctz(sl_map);
+        return (mem_block_t*)((void*)heap.free_lists[fl][sl].next - offsetof(mem_block_t, list));
+}
+
+static mem_block_t* _heap_merge(mem_block_t *block) {
+        mem_block_t *next = _next_phys(block);
+        if (next->free == 1) {
+                _heap_remove(next);
+                block->sz += BLOCK_HDR_SIZE + next->sz;
+                _next_phys(block)->prev_phys = block;
+                next->ptr = NULL;
+        }
+
+        mem_block_t *prev = block->prev_phys;
+        if (prev != NULL && prev->free == 1) {
+                _heap_remove(prev);
+                prev->sz += BLOCK_HDR_SIZE + block->sz;
+                _next_phys(prev)->prev_phys = prev;
+                block->ptr = NULL;
+                block = prev;
+        }
+        return block;
+}
+
+static void _heap_split(mem_block_t *block, size_t sz) {
+        if (block->sz < sz + BLOCK_HDR_SIZE + MIN_SPLIT_SIZE)
+                return;
+
+        mem_block_t *rest = (mem_block_t*)((uintptr_t)block->ptr + sz);
+        rest->ptr = (void*)((uintptr_t)rest + BLOCK_HDR_SIZE);
+        rest->sz = block->sz - sz - BLOCK_HDR_SIZE;
+        rest->free = 0;
+        rest->prev_phys = block;
+        _next_phys(rest)->prev_phys = rest;
+        block->sz = sz;
+        _heap_insert(_heap_merge(rest));
+}
+
+static int _heap_grow(void) {
+        pthread_mutex_lock(&arena_lock);
+        struct arena *arena = _new_arena(ARENA_HEAP);
+        pthread_mutex_unlock(&arena_lock);
+        if (arena == NULL)
+                return -1;
+
+        mem_block_t *block = (mem_block_t*)arena->base;
+        block->ptr = (void*)(arena->base + BLOCK_HDR_SIZE);
+        block->sz = ARENA_SIZE - 2 * BLOCK_HDR_SIZE;
+        block->prev_phys = NULL;
+
+        mem_block_t *end = _next_phys(block);
+        end->ptr = (void*)((uintptr_t)end + BLOCK_HDR_SIZE);
+        end->sz = 0;
+        end->free = 0;
+        end->prev_phys = block;
+        _heap_insert(block);
+        return 0;
+}
+
+static mem_block_t* _heap_align(mem_block_t *block, size_t align) {
+        if (((uintptr_t)block->ptr & (align - 1)) == 0)
+                return block;
+
+        uintptr_t ptr = (uintptr_t)block->ptr + BLOCK_HDR_SIZE + MIN_SPLIT_SIZE;
+        ptr = (ptr + align - 1) & ~(uintptr_t)(align - 1);
+        mem_block_t *ret = (mem_block_t*)(ptr - BLOCK_HDR_SIZE);
+        ret->ptr = (void*)ptr;
+        ret->sz = (uintptr_t)block->ptr + block->sz - ptr;
+        ret->free = 0;
+        ret->prev_phys = block;
+        _next_phys(ret)->prev_phys = ret;
+        block->sz = (uintptr_t)ret - (uintptr_t)block->ptr;
+        _heap_insert(block);
+        return ret;
+}
+
+static mem_block_t* _heap_alloc(size_t sz, size_t align) {
+        sz = (sz + MIN_OBJ_SIZE - 1) & ~(size_t)(MIN_OBJ_SIZE - 1);
+        size_t search_sz = sz;
+        if (align > MIN_OBJ_SIZE)
+                search_sz += align + BLOCK_HDR_SIZE + MIN_SPLIT_SIZE;
+
+        mem_block_t *block = _heap_find(search_sz);
+        if (block == NULL) {
+                if (_heap_grow() != 0)
+                        return NULL;
+                block = _heap_find(search_sz);
+                if (block == NULL)
+                        return NULL;
+        }
+
+        _heap_remove(block);
+        if (align > MIN_OBJ_SIZE)
+                block = _heap_align(block, align);
+        _heap_split(block, sz);
+        block->align = align;
+        heap.used_bytes += block->sz;
+        return block;
+}
+
+static void _heap_free(struct arena *arena, mem_block_t *block) {
+        heap.used_bytes -= block->sz;
+        if (block->sz >= DECOMMIT_SIZE)
+                _decommit(block->ptr, block->sz, arena->page_size);
+        _heap_insert(_heap_merge(block));
+}
+
+static mem_block_t* _heap_resize(mem_block_t *block, size_t sz) {
+        sz = (sz + MIN_OBJ_SIZE - 1) & ~(size_t)(MIN_OBJ_SIZE - 1);
+        mem_block_t *next = _next_phys(block);
+        if (sz > block->sz && (next->free == 0 || block->sz + BLOCK_HDR_SIZE + next->sz < sz))
+                return NULL;
+
+        heap.used_bytes -= block->sz;
+        if (sz > block->sz) {
+                _heap_remove(next);
+                block->sz += BLOCK_HDR_SIZE + next->sz;
+                _next_phys(block)->prev_phys = block;
+                next->ptr = NULL;
+        }
+        _heap_split(block, sz);
+        heap.used_bytes += block->sz;
+        return block;
+}
+
+static inline mem_block_t* _find_block(void *ptr) {
+        mem_block_t *block = (mem_block_t*)((uintptr_t)ptr - BLOCK_HDR_SIZE);
+        if (block->ptr != ptr || block->free != 0)
+                return NULL;
+        return block;
+}
+
+static mem_block_t* _alloc_block(size_t sz, size_t align) {
+        RUNE_PROFILE_SCOPE("Block allocation");
+        size_t offset = BLOCK_HDR_SIZE;
+        if (align > MIN_OBJ_SIZE)
+                offset = PAGE_SIZE;
+
+        size_t page_size = PAGE_SIZE;
+        if (atomic_load_explicit(&hugepage_mode, memory_order_relaxed) == ALLOC_HUGEPAGES_EXPLICIT)
+                page_size = HUGE_PAGE_SIZE;
+
+        int huge;
+        size_t map_sz = (offset + sz + page_size - 1) & ~(size_t)(page_size - 1);
+        void *base = _map_region(map_sz, &huge);
+        if (base == NULL) {
                 RUNE_PROFILE_END();
-                log_output(LOG_ERROR, "Cannot allocate block of size %d", sz);
+                log_output(LOG_ERROR, "Cannot allocate block of size %zu", sz);
                 return NULL;
         }
 
-        ret->ptr = malloc(sz);
-        ret->sz = sz;
+        mem_block_t *ret = (mem_block_t*)((uintptr_t)base + offset - BLOCK_HDR_SIZE);
+        ret->ptr = (void*)((uintptr_t)base + offset);
+        ret->sz = map_sz - offset;
         ret->free = 0;
-        list_add(&ret->list, &first_block.list);
+        ret->align = align;
+        ret->prev_phys = NULL;
+        pthread_mutex_lock(&block_lock);
+        list_insert(&ret->list, &first_block.list);
+        pthread_mutex_unlock(&block_lock);
         RUNE_PROFILE_END();
-        log_output(LOG_DEBUG, "Alloc'd block of size %d", sz);
+        RLOG_DEBUG("Alloc'd block of size %zu", sz);
         return ret;
 }
 
-static void _free_block(mem_block_t *block, int hard) {
+static void _free_block(mem_block_t *block) {
         RUNE_PROFILE_SCOPE("Block free");
-        if (hard == 1) {
-                list_del(&block->list);
-                RUNE_PROFILE_END();
-                free(block);
-                log_output(LOG_DEBUG, "Freed block of size %d", block->sz);
+        size_t sz = block->sz;
+        pthread_mutex_lock(&block_lock);
+        list_del(&block->list);
+        pthread_mutex_unlock(&block_lock);
+        uintptr_t base = (uintptr_t)block & ~(uintptr_t)(PAGE_SIZE - 1);
+        uintptr_t end = (uintptr_t)block->ptr + sz;
+        block->ptr = NULL;
+        _unmap_region((void*)base, end - base);
+        RUNE_PROFILE_END();
+        RLOG_DEBUG("Freed block of size %zu", sz);
+}
+
+static void* _alloc_large(size_t sz, size_t align, int tag) {
+        mem_block_t *block;
+        if (sz >= DIRECT_SIZE) {
+                block = _alloc_block(sz, align);
+        } else {
+                pthread_mutex_lock(&heap_lock);
+                block = _heap_alloc(sz, align);
+                pthread_mutex_unlock(&heap_lock);
+        }
+
+        if (block == NULL)
+                return NULL;
+        block->tag = tag;
+        _tag_charge(tag, block->sz);
+        return block->ptr;
+}
+
+static void _free_large(struct arena *arena, mem_block_t *block) {
+        _tag_credit(block->tag, block->sz);
+        if (arena == NULL) {
+                _free_block(block);
                 return;
         }
-        block->free = 1;
+
+        pthread_mutex_lock(&heap_lock);
+        _heap_free(arena, block);
+        pthread_mutex_unlock(&heap_lock);
+}
+
+static void* _alloc(size_t sz, size_t align, int tag) {
+        if (tag < 0 || tag >= atomic_load_explicit(&num_tags, memory_order_relaxed))
+                tag = MEM_TAG_GENERAL;
+        if (atomic_load_explicit(&initialized, memory_order_acquire) == 0)
+                _init_classes();
+
+        void *ret = NULL;
+        if (sz <= MAX_SMALL_SIZE && align <= CACHE_LINE) {
+                int index = class_index[(sz + MIN_OBJ_SIZE - 1) / MIN_OBJ_SIZE];
+                while (index < NUM_CLASSES && (class_sizes[index] & (align - 1)) != 0)
+                        index++;
+                if (index < NUM_CLASSES)
+                        ret = _small_alloc(index, tag);
+        }
+
+        if (ret == NULL)
+                ret = _alloc_large(sz, align, tag);
+        return ret;
+}
+
+static void _trace_flush(void) {
+        if (trace_count == 0)
+                return;
+        if (fwrite(trace_buf, sizeof(alloc_trace_record_t), trace_count, trace_file) != (size_t)trace_count)
+                log_output(LOG_ERROR, "Cannot write allocation trace");
+        trace_count = 0;
+}
+
+static void _trace(int op, void *ptr, void *old_ptr, size_t sz, size_t align, int tag) {
+        if (trace_thread == 0)
+                trace_thread = atomic_fetch_add(&trace_threads, 1) + 1;
+
+        struct timespec now;
+        pthread_mutex_lock(&trace_lock);
+        if (trace_file == NULL) {
+                pthread_mutex_unlock(&trace_lock);
+                return;
+        }
+
+        timespec_get(&now, TIME_UTC);
+        alloc_trace_record_t *rec = &trace_buf[trace_count++];
+        rec->timestamp = (int64_t)(now.tv_sec - trace_start.tv_sec) * 1000000000
+                       + (now.tv_nsec - trace_start.tv_nsec);
+        rec->ptr = (uintptr_t)ptr;
+        rec->old_ptr = (uintptr_t)old_ptr;
+        rec->size = sz;
+        rec->thread = trace_thread;
+        rec->op = op;
+        rec->tag = tag;
+        rec->align_shift = __builtin_ctzll(align);
+        rec->reserved = 0;
+        if (trace_count == TRACE_BUF_LEN)
+                _trace_flush();
+        pthread_mutex_unlock(&trace_lock);
+}
+
+static inline int _tracing(void) {
+        return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+static void* _realloc_small(struct slab *slab, void *ptr, size_t sz) {
+        size_t old_sz = slab->class->sz;
+        if (sz <= old_sz && sz > old_sz / 2)
+                return ptr;
+
+        void *ret = _alloc(sz, MIN_OBJ_SIZE, *_slab_tag(slab, ptr));
+        if (ret == NULL)
+                return NULL;
+        memcpy(ret, ptr, old_sz < sz ? old_sz : sz);
+        _small_free(slab, ptr);
+        return ret;
+}
+
+static void* _realloc_large(struct arena *arena, mem_block_t *block, size_t sz) {
+        if (sz <= block->sz && sz > block->sz / 2)
+                return block->ptr;
+
+        if (arena != NULL && sz > MAX_SMALL_SIZE) {
+                size_t old_sz = block->sz;
+                pthread_mutex_lock(&heap_lock);
+                mem_block_t *ret = _heap_resize(block, sz);
+                pthread_mutex_unlock(&heap_lock);
+                if (ret != NULL) {
+                        atomic_fetch_sub_explicit(&tag_stats[block->tag].current, old_sz, memory_order_relaxed);
+                        _tag_grow(block->tag, block->sz);
+                        return block->ptr;
+                }
+        }
+
+        void *ret = _alloc(sz, MIN_OBJ_SIZE, block->tag);
+        if (ret == NULL)
+                return NULL;
+        memcpy(ret, block->ptr, block->sz < sz ? block->sz : sz);
+        _free_large(arena, block);
+        return ret;
 }
 
 void* rune_alloc(size_t sz) {
+        return rune_alloc_tagged(sz, MEM_TAG_GENERAL);
+}
+
+void* rune_alloc_tagged(size_t sz, int tag) {
         if (sz == 0)
                 return NULL;
 
         RUNE_PROFILE_SCOPE("Pool allocation");
-        mem_block_t *block = _find_free_block(sz);
-        if (block != NULL) {
-                block->free = 0;
-                RUNE_PROFILE_END();
-                return block->ptr;
+        void *ret = _alloc(sz, MIN_OBJ_SIZE, tag);
+        if (_tracing() && ret != NULL)
+                _trace(ALLOC_TRACE_ALLOC, ret, NULL, sz, MIN_OBJ_SIZE, tag);
+        RUNE_PROFILE_END();
+        return ret;
+}
+
+void* rune_alloc_aligned(size_t sz, size_t align) {
+        return rune_alloc_aligned_tagged(sz, align, MEM_TAG_GENERAL);
+}
+
+void* rune_alloc_aligned_tagged(size_t sz, size_t align, int tag) {
+        if (align <= MIN_OBJ_SIZE)
+                return rune_alloc_tagged(sz, tag);
+
+        if (sz == 0 || (align & (align - 1)) != 0)
+                return NULL;
+        if (align > SLAB_SIZE || (sz >= DIRECT_SIZE && align > PAGE_SIZE)) {
+                log_output(LOG_ERROR, "Unsupported alignment %zu for block of size %zu", align, sz);
+                return NULL;
         }
 
-        block = _alloc_block(sz);
+        RUNE_PROFILE_SCOPE("Aligned pool allocation");
+        void *ret = _alloc(sz, align, tag);
+        if (_tracing() && ret != NULL)
+                _trace(ALLOC_TRACE_ALLOC, ret, NULL, sz, align, tag);
         RUNE_PROFILE_END();
-        return block->ptr;
+        return ret;
 }
 
 void* rune_calloc(size_t nmemb, size_t sz) {
+        return rune_calloc_tagged(nmemb, sz, MEM_TAG_GENERAL);
+}
+
+void* rune_calloc_tagged(size_t nmemb, size_t sz, int tag) {
         if (sz == 0)
                 return NULL;
 
         RUNE_PROFILE_SCOPE("Zero array pool allocation");
-        mem_block_t *block = _find_free_block(sz);
-        if (block != NULL) {
-                block->free = 0;
-                RUNE_PROFILE_END();
-                return block->ptr;
-        }
-
-        block = _alloc_block(sz);
-        memset(block->ptr, 0, sz);
+        void *ret = rune_alloc_tagged(sz, tag);
+        if (ret != NULL)
+                memset(ret, 0, sz);
         RUNE_PROFILE_END();
-        return block->ptr;
+        return ret;
 }
 
 void* rune_realloc(void *ptr, size_t sz) {
@@ -137,12 +982,22 @@ void* rune_realloc(void *ptr, size_t sz) {
                 return rune_alloc(sz);
 
         RUNE_PROFILE_SCOPE("Pool reallocation");
-        mem_block_t *old = _find_block(ptr);
-        mem_block_t *new = _alloc_block(sz);
-        memcpy(new->ptr, old->ptr, old->sz);
-        old->free = 1;
+        void *ret = NULL;
+        struct arena *arena = _find_arena(ptr);
+        mem_block_t *block;
+        if (arena != NULL && arena->kind == ARENA_SLAB) {
+                struct slab *slab = (struct slab*)((uintptr_t)ptr & ~(SLAB_SIZE - 1));
+                ret = _realloc_small(slab, ptr, sz);
+        } else if ((block = _find_block(ptr)) != NULL) {
+                ret = _realloc_large(arena, block, sz);
+        } else {
+                log_output(LOG_ERROR, "Attempted to realloc unknown pointer %p", ptr);
+        }
+
+        if (_tracing() && ret != NULL)
+                _trace(ALLOC_TRACE_REALLOC, ret, ptr, sz, MIN_OBJ_SIZE, 0);
         RUNE_PROFILE_END();
-        return new->ptr;
+        return ret;
 }
 
 void rune_free(void *ptr) {
@@ -150,29 +1005,466 @@ void rune_free(void *ptr) {
                 return;
 
         RUNE_PROFILE_SCOPE("Pool free");
+        if (_tracing())
+                _trace(ALLOC_TRACE_FREE, ptr, NULL, 0, 1, 0);
+        struct arena *arena = _find_arena(ptr);
+        if (arena != NULL && arena->kind == ARENA_SLAB) {
+                struct slab *slab = (struct slab*)((uintptr_t)ptr & ~(SLAB_SIZE - 1));
+                _small_free(slab, ptr);
+                RUNE_PROFILE_END();
+                return;
+        }
+
         mem_block_t *block = _find_block(ptr);
-        if (block->free == 1) {
+        if (block == NULL) {
                 RUNE_PROFILE_END();
+                log_output(LOG_ERROR, "Attempted to free unknown pointer %p", ptr);
                 return;
         }
-        block->free = 1;
+        _free_large(arena, block);
         RUNE_PROFILE_END();
 }
 
 void rune_free_all(void) {
         RUNE_PROFILE_SCOPE("Pool free all");
-        list_head_t *temp = &first_block.list;
+        rune_alloc_trace_stop();
+        rune_frame_alloc_close();
+        list_head_t *temp = first_block.list.next;
         mem_block_t *block;
         while (temp != NULL) {
                 block = (mem_block_t*)((void*)temp - offsetof(mem_block_t, list));
-                if (block->ptr == DEADBLOCK) {
-                        temp = temp->next;
+                temp = temp->next;
+                _free_block(block);
+        }
+
+        for (int i = 0; i < atomic_load(&num_arenas); i++)
+                _unmap_region(arenas[i].raw, arenas[i].raw_sz);
+        atomic_store(&num_arenas, 0);
+        for (int i = 0; i < MEM_TAG_MAX; i++) {
+                atomic_store(&tag_stats[i].current, 0);
+                atomic_store(&tag_stats[i].count, 0);
+        }
+        atomic_store(&initialized, 0);
+        atomic_fetch_add(&alloc_gen, 1);
+        RUNE_PROFILE_END();
+}
+
+float rune_alloc_fragmentation(void) {
+        pthread_mutex_lock(&heap_lock);
+        if (heap.free_bytes == 0) {
+                pthread_mutex_unlock(&heap_lock);
+                return 0.0f;
+        }
+
+        int fl = _fls(heap.fl_bitmap);
+        int sl = _fls(heap.sl_bitmap[fl]);
+        size_t largest = 0;
+        list_head_t *temp = heap.free_lists[fl][sl].next;
+        mem_block_t *block;
+        while (temp != NULL) {
+                block = (mem_block_t*)((void*)temp - offsetof(mem_block_t, list));
+                if (block->sz > largest)
+                        largest = block->sz;
+                temp = temp->next;
+        }
+        float ret = 1.0f - (float)largest / (float)heap.free_bytes;
+        pthread_mutex_unlock(&heap_lock);
+        return ret;
+}
+
+void rune_alloc_set_hugepages(int mode) {
+        if (mode < ALLOC_HUGEPAGES_OFF || mode > ALLOC_HUGEPAGES_EXPLICIT)
+                return;
+        atomic_store(&hugepage_mode, mode);
+        atomic_store(&hugepage_warned, 0);
+}
+
+#ifdef __linux__
+static int _owns_range(uintptr_t start, uintptr_t end) {
+        for (int i = 0; i < atomic_load(&num_arenas); i++) {
+                if (start < (uintptr_t)arenas[i].raw + arenas[i].raw_sz && end > (uintptr_t)arenas[i].raw)
+                        return 1;
+        }
+
+        for (uint8_t i = 0; i < num_frames; i++) {
+                if (start < frame_arenas[i].base + frame_arenas[i].sz && end > frame_arenas[i].base)
+                        return 1;
+        }
+
+        int ret = 0;
+        mem_block_t *block;
+        pthread_mutex_lock(&block_lock);
+        for (list_head_t *temp = first_block.list.next; temp != NULL; temp = temp->next) {
+                block = (mem_block_t*)((void*)temp - offsetof(mem_block_t, list));
+                if (start < (uintptr_t)block->ptr + block->sz && end > (uintptr_t)block) {
+                        ret = 1;
+                        break;
+                }
+        }
+        pthread_mutex_unlock(&block_lock);
+        return ret;
+}
+#endif
+
+int rune_alloc_hugepage_coverage(size_t *resident, size_t *huge) {
+#ifdef __linux__
+        FILE *file = fopen("/proc/self/smaps", "r");
+        if (file == NULL)
+                return -1;
+
+        char line[256];
+        unsigned long start;
+        unsigned long end;
+        size_t kb;
+        int owned = 0;
+        *resident = 0;
+        *huge = 0;
+        while (fgets(line, sizeof(line), file) != NULL) {
+                if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+                        owned = _owns_range(start, end);
                         continue;
                 }
+                if (owned == 0)
+                        continue;
 
-                temp = temp->next;
-                if (block->ptr != NULL)
-                        _free_block(block, 1);
+                if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+                        *resident += kb << 10;
+                } else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+                        *huge += kb << 10;
+                } else if (sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1) {
+                        *resident += kb << 10;
+                        *huge += kb << 10;
+                }
         }
-        RUNE_PROFILE_END();
+        fclose(file);
+        return 0;
+#else
+        return -1;
+#endif
+}
+
+int rune_alloc_trace_start(const char *path) {
+        rune_alloc_trace_stop();
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+                log_output(LOG_ERROR, "Cannot open allocation trace %s", path);
+                return -1;
+        }
+
+        alloc_trace_header_t header = {
+                .magic = ALLOC_TRACE_MAGIC,
+                .version = ALLOC_TRACE_VERSION,
+                .record_size = sizeof(alloc_trace_record_t),
+                .reserved = 0
+        };
+        if (fwrite(&header, sizeof(header), 1, file) != 1) {
+                log_output(LOG_ERROR, "Cannot write allocation trace %s", path);
+                fclose(file);
+                return -1;
+        }
+
+        pthread_mutex_lock(&trace_lock);
+        trace_file = file;
+        trace_count = 0;
+        timespec_get(&trace_start, TIME_UTC);
+        atomic_store(&tracing, 1);
+        pthread_mutex_unlock(&trace_lock);
+        log_output(LOG_INFO, "Recording allocation trace to %s", path);
+        return 0;
+}
+
+void rune_alloc_trace_stop(void) {
+        pthread_mutex_lock(&trace_lock);
+        if (trace_file == NULL) {
+                pthread_mutex_unlock(&trace_lock);
+                return;
+        }
+
+        atomic_store(&tracing, 0);
+        _trace_flush();
+        fclose(trace_file);
+        trace_file = NULL;
+        pthread_mutex_unlock(&trace_lock);
+}
+
+int rune_mem_register_tag(const char *name) {
+        pthread_mutex_lock(&tag_lock);
+        int ret = atomic_load(&num_tags);
+        if (ret == MEM_TAG_MAX) {
+                pthread_mutex_unlock(&tag_lock);
+                log_output(LOG_ERROR, "Cannot register memory tag %s, all tags are in use", name);
+                return -1;
+        }
+
+        tag_stats[ret].name = name;
+        atomic_store_explicit(&num_tags, ret + 1, memory_order_release);
+        pthread_mutex_unlock(&tag_lock);
+        return ret;
+}
+
+int rune_mem_num_tags(void) {
+        return atomic_load_explicit(&num_tags, memory_order_acquire);
+}
+
+int rune_mem_get_stats(int tag, mem_stats_t *stats) {
+        if (tag < 0 || tag >= rune_mem_num_tags())
+                return -1;
+
+        struct tag_stats *src = &tag_stats[tag];
+        stats->name = src->name;
+        stats->current = atomic_load_explicit(&src->current, memory_order_relaxed);
+        stats->peak = atomic_load_explicit(&src->peak, memory_order_relaxed);
+        stats->count = atomic_load_explicit(&src->count, memory_order_relaxed);
+        stats->total = atomic_load_explicit(&src->total, memory_order_relaxed);
+        stats->budget = atomic_load_explicit(&src->budget, memory_order_relaxed);
+        return 0;
+}
+
+void rune_mem_set_budget(int tag, size_t budget) {
+        if (tag < 0 || tag >= rune_mem_num_tags())
+                return;
+        atomic_store(&tag_stats[tag].budget, budget);
+        atomic_store(&tag_stats[tag].over_budget, 0);
+}
+
+void rune_mem_set_dump_interval(uint32_t seconds) {
+        atomic_store(&dump_interval, seconds);
+}
+
+void rune_mem_dump_stats(void) {
+        mem_stats_t stats;
+        log_output(LOG_INFO, "Memory usage by tag:");
+        for (int i = 0; i < rune_mem_num_tags(); i++) {
+                rune_mem_get_stats(i, &stats);
+                if (stats.total == 0)
+                        continue;
+                log_output(LOG_INFO, "%-10s current %zu peak %zu live %zu total %zu budget %zu",
+                                stats.name, stats.current, stats.peak,
+                                stats.count, stats.total, stats.budget);
+        }
+
+        size_t resident;
+        size_t huge;
+        if (rune_alloc_hugepage_coverage(&resident, &huge) == 0 && resident > 0)
+                log_output(LOG_INFO, "Huge pages back %zu of %zu resident KiB (%.1f%%)",
+                                huge >> 10, resident >> 10, 100.0 * huge / resident);
+}
+
+void rune_mem_tick(void) {
+        struct tag_stats *stats;
+        size_t budget;
+        size_t peak;
+        for (int i = 0; i < rune_mem_num_tags(); i++) {
+                stats = &tag_stats[i];
+                budget = atomic_load_explicit(&stats->budget, memory_order_relaxed);
+                if (budget == 0)
+                        continue;
+
+                peak = atomic_load_explicit(&stats->peak, memory_order_relaxed);
+                if (peak > budget && atomic_exchange(&stats->over_budget, 1) == 0)
+                        log_output(LOG_WARN, "Memory tag %s exceeded its budget of %zu bytes, peak %zu",
+                                        stats->name, budget, peak);
+        }
+
+        uint32_t interval = atomic_load_explicit(&dump_interval, memory_order_relaxed);
+        if (interval == 0)
+                return;
+
+        time_t now = time(NULL);
+        if (now - last_dump < interval)
+                return;
+        last_dump = now;
+        rune_mem_dump_stats();
+}
+
+static inline void _pool_lock(mem_pool_t *pool) {
+        while (atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire))
+                ;
+}
+
+static inline void _pool_unlock(mem_pool_t *pool) {
+        atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
+static int _pool_grow(mem_pool_t *pool) {
+        void **chunk = rune_alloc_tagged(MIN_OBJ_SIZE + pool->elem_size * pool->count, pool->tag);
+        if (chunk == NULL)
+                return -1;
+
+        *chunk = pool->chunks;
+        pool->chunks = chunk;
+
+        uintptr_t start = (uintptr_t)chunk + MIN_OBJ_SIZE;
+        void *elem;
+        for (size_t i = pool->count; i > 0; i--) {
+                elem = (void*)(start + (i - 1) * pool->elem_size);
+                *(void**)elem = pool->free_list;
+                pool->free_list = elem;
+        }
+        return 0;
+}
+
+mem_pool_t* rune_pool_create(size_t elem_size, size_t count) {
+        return rune_pool_create_tagged(elem_size, count, MEM_TAG_GENERAL);
+}
+
+mem_pool_t* rune_pool_create_tagged(size_t elem_size, size_t count, int tag) {
+        if (elem_size == 0 || count == 0)
+                return NULL;
+
+        mem_pool_t *ret = rune_alloc_tagged(sizeof(mem_pool_t), tag);
+        if (ret == NULL)
+                return NULL;
+
+        if (elem_size < sizeof(void*))
+                elem_size = sizeof(void*);
+        ret->elem_size = (elem_size + MIN_OBJ_SIZE - 1) & ~(size_t)(MIN_OBJ_SIZE - 1);
+        ret->count = count;
+        ret->tag = tag;
+        ret->free_list = NULL;
+        ret->chunks = NULL;
+        atomic_flag_clear(&ret->lock);
+        if (_pool_grow(ret) != 0) {
+                rune_free(ret);
+                return NULL;
+        }
+        return ret;
+}
+
+void rune_pool_destroy(mem_pool_t *pool) {
+        if (pool == NULL)
+                return;
+
+        void *chunk = pool->chunks;
+        void *next;
+        while (chunk != NULL) {
+                next = *(void**)chunk;
+                rune_free(chunk);
+                chunk = next;
+        }
+        rune_free(pool);
+}
+
+void* rune_pool_alloc(mem_pool_t *pool) {
+        _pool_lock(pool);
+        if (pool->free_list == NULL && _pool_grow(pool) != 0) {
+                _pool_unlock(pool);
+                log_output(LOG_ERROR, "Cannot grow pool of %zu byte elements", pool->elem_size);
+                return NULL;
+        }
+
+        void *ret = pool->free_list;
+        pool->free_list = *(void**)ret;
+        _pool_unlock(pool);
+        return ret;
+}
+
+void rune_pool_free(mem_pool_t *pool, void *ptr) {
+        if (ptr == NULL)
+                return;
+
+        _pool_lock(pool);
+        *(void**)ptr = pool->free_list;
+        pool->free_list = ptr;
+        _pool_unlock(pool);
+}
+
+static void _frame_release_overflow(struct frame_arena *arena) {
+        struct frame_overflow *node = atomic_exchange(&arena->overflow, NULL);
+        struct frame_overflow *next;
+        while (node != NULL) {
+                next = node->next;
+                rune_free(node);
+                node = next;
+        }
+}
+
+static void* _frame_alloc_overflow(struct frame_arena *arena, size_t sz) {
+        struct frame_overflow *node = rune_alloc_tagged(sizeof(struct frame_overflow) + sz, MEM_TAG_FRAME);
+        if (node == NULL)
+                return NULL;
+
+        node->next = atomic_load(&arena->overflow);
+        while (!atomic_compare_exchange_weak(&arena->overflow, &node->next, node))
+                ;
+        if (node->next == NULL)
+                log_output(LOG_WARN, "Frame arena exhausted, falling back to heap allocation");
+        return node->data;
+}
+
+int rune_frame_alloc_init(uint8_t frames, size_t sz) {
+        if (frame_arenas != NULL)
+                rune_frame_alloc_close();
+
+        sz = (sz + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+        frame_arenas = rune_calloc(0, sizeof(struct frame_arena) * frames);
+        if (frame_arenas == NULL)
+                return -1;
+
+        int huge;
+        for (uint8_t i = 0; i < frames; i++) {
+                frame_arenas[i].base = (uintptr_t)_map_region(sz, &huge);
+                if (frame_arenas[i].base == 0) {
+                        log_output(LOG_ERROR, "Cannot reserve frame arena of size %zu", sz);
+                        num_frames = i;
+                        rune_frame_alloc_close();
+                        return -1;
+                }
+                frame_arenas[i].sz = sz;
+                atomic_init(&frame_arenas[i].used, 0);
+                atomic_init(&frame_arenas[i].overflow, NULL);
+        }
+        num_frames = frames;
+        atomic_store(&cur_frame, &frame_arenas[0]);
+        RLOG_DEBUG("Initialized %d frame arenas of size %zu", frames, sz);
+        return 0;
+}
+
+void rune_frame_alloc_close(void) {
+        if (frame_arenas == NULL)
+                return;
+
+        for (uint8_t i = 0; i < num_frames; i++) {
+                _frame_release_overflow(&frame_arenas[i]);
+                _unmap_region((void*)frame_arenas[i].base, frame_arenas[i].sz);
+        }
+        rune_free(frame_arenas);
+        frame_arenas = NULL;
+        atomic_store(&cur_frame, NULL);
+        num_frames = 0;
+}
+
+void rune_frame_begin(uint32_t frame) {
+        if (frame_arenas == NULL)
+                return;
+
+        struct frame_arena *arena = &frame_arenas[frame % num_frames];
+        _frame_release_overflow(arena);
+        atomic_store(&arena->used, 0);
+        atomic_store_explicit(&cur_frame, arena, memory_order_release);
+}
+
+static void* _frame_alloc(struct frame_arena *arena, size_t sz) {
+        sz = (sz + MIN_OBJ_SIZE - 1) & ~(size_t)(MIN_OBJ_SIZE - 1);
+        size_t offset = atomic_fetch_add_explicit(&arena->used, sz, memory_order_relaxed);
+        if (offset + sz > arena->sz)
+                return _frame_alloc_overflow(arena, sz);
+        return (void*)(arena->base + offset);
+}
+
+void* rune_frame_alloc(size_t sz) {
+        struct frame_arena *arena = atomic_load_explicit(&cur_frame, memory_order_acquire);
+        if (sz == 0 || arena == NULL)
+                return NULL;
+        return _frame_alloc(arena, sz);
+}
+
+uint8_t rune_frame_count(void) {
+        return num_frames;
+}
+
+void* rune_frame_alloc_for(uint64_t frame, size_t sz) {
+        if (sz == 0 || frame_arenas == NULL)
+                return NULL;
+        return _frame_alloc(&frame_arenas[frame % num_frames], sz);
 }
@@ -0,0 +1,447 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Binary logging defers formatting to rune-logdecode. Each format string is
+ * parsed once when it is registered, which turns its conversions into a
+ * signature: one character per argument saying how to fetch it with va_arg.
+ * A message then only has to walk the signature and copy each argument into
+ * the calling thread's buffer.
+ *
+ * Buffers live in static storage and a thread claims one on its first
+ * message. A full buffer is written to the file by the thread that filled
+ * it, and rune_binlog_flush writes out every buffer. Records from
+ * different threads are interleaved in buffer-sized chunks, so the decoder
+ * sorts them by timestamp. Format definitions are written to the file as
+ * soon as they are registered, so they always come before the records that
+ * use them.
+ */
+
+#include <rune/core/binlog.h>
+#include "futex.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_FORMATS     4096
+#define MAX_ARGS        32
+#define MAX_BUFFERS     64
+#define BUFFER_SIZE     32768
+
+struct binlog_format {
+        const char *fmt;
+        int level;
+        uint16_t max_size;
+        char sig[MAX_ARGS + 1];
+};
+
+struct binlog_buffer {
+        pthread_mutex_t lock;
+        atomic_int owner;
+        uint16_t thread;
+        uint32_t session;
+        size_t used;
+        unsigned char data[BUFFER_SIZE];
+};
+
+static struct binlog_format formats[MAX_FORMATS];
+static atomic_uint num_formats = 0;
+static pthread_mutex_t format_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct binlog_buffer buffers[MAX_BUFFERS];
+static _Thread_local struct binlog_buffer *thread_buffer = NULL;
+static atomic_uint num_threads = 0;
+static pthread_key_t buffer_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static FILE *log_file = NULL;
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t start_ns = 0;
+static atomic_int active = 0;
+static atomic_uint session = 0;
+static atomic_size_t dropped = 0;
+
+static int _parse_format(const char *fmt, char *sig) {
+        int nargs = 0;
+        const char *c = fmt;
+        while ((c = strchr(c, '%')) != NULL) {
+                c++;
+                if (*c == '%') {
+                        c++;
+                        continue;
+                }
+
+                while (*c != '\0' && strchr("-+ #0'", *c) != NULL)
+                        c++;
+                for (int part = 0; part < 2; part++) {
+                        if (*c == '*') {
+                                if (nargs == MAX_ARGS)
+                                        return -1;
+                                sig[nargs++] = 'i';
+                                c++;
+                        }
+                        while (*c >= '0' && *c <= '9')
+                                c++;
+                        if (part == 0 && *c == '.')
+                                c++;
+                        else
+                                break;
+                }
+
+                char len = ' ';
+                if (c[0] == 'h' && c[1] == 'h') {
+                        len = 'b';
+                        c += 2;
+                } else if (c[0] == 'l' && c[1] == 'l') {
+                        len = 'q';
+                        c += 2;
+                } else if (*c != '\0' && strchr("hljztL", *c) != NULL) {
+                        len = *c++;
+                }
+
+                char kind;
+                switch (*c) {
+                        case 'd':
+                        case 'i':
+                        case 'o':
+                        case 'u':
+                        case 'x':
+                        case 'X':
+                                kind = len == ' ' ? 'i' : len;
+                                if (len == 'L')
+                                        return -1;
+                                if (strchr("ouxX", *c) != NULL && strchr("ibhl", kind) != NULL)
+                                        kind = kind - 'a' + 'A';
+                                break;
+                        case 'c':
+                                if (len != ' ')
+                                        return -1;
+                                kind = 'i';
+                                break;
+                        case 'a':
+                        case 'A':
+                        case 'e':
+                        case 'E':
+                        case 'f':
+                        case 'F':
+                        case 'g':
+                        case 'G':
+                                if (len == 'L')
+                                        return -1;
+                                kind = 'd';
+                                break;
+                        case 'p':
+                                kind = 'p';
+                                break;
+                        case 's':
+                                if (len != ' ')
+                                        return -1;
+                                kind = 's';
+                                break;
+                        default:
+                                return -1;
+                }
+                if (nargs == MAX_ARGS)
+                        return -1;
+                sig[nargs++] = kind;
+                c++;
+        }
+        sig[nargs] = '\0';
+        return nargs;
+}
+
+static void _write_format(uint32_t id) {
+        struct binlog_format *format = &formats[id - 1];
+        size_t fmt_len = strlen(format->fmt) + 1;
+        binlog_record_t record = {
+                .timestamp = 0,
+                .size = sizeof(record) + 2 * sizeof(uint16_t) + fmt_len,
+                .id = BINLOG_FORMAT_ID,
+                .thread = 0,
+                .reserved = 0
+        };
+        uint16_t def[2] = { id, format->level };
+        fwrite(&record, sizeof(record), 1, log_file);
+        fwrite(def, sizeof(def), 1, log_file);
+        fwrite(format->fmt, fmt_len, 1, log_file);
+}
+
+static void _flush_buffer(struct binlog_buffer *buf) {
+        if (buf->used == 0)
+                return;
+
+        pthread_mutex_lock(&file_lock);
+        if (log_file != NULL && buf->session == atomic_load(&session))
+                fwrite(buf->data, buf->used, 1, log_file);
+        pthread_mutex_unlock(&file_lock);
+        buf->used = 0;
+}
+
+static void _release_buffer(void *arg) {
+        struct binlog_buffer *buf = arg;
+        pthread_mutex_lock(&buf->lock);
+        _flush_buffer(buf);
+        pthread_mutex_unlock(&buf->lock);
+        atomic_store_explicit(&buf->owner, 0, memory_order_release);
+}
+
+static void _create_key(void) {
+        for (int i = 0; i < MAX_BUFFERS; i++)
+                pthread_mutex_init(&buffers[i].lock, NULL);
+        pthread_key_create(&buffer_key, _release_buffer);
+}
+
+static struct binlog_buffer* _thread_buffer(void) {
+        if (thread_buffer != NULL)
+                return thread_buffer;
+
+        int expected;
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+                expected = 0;
+                if (!atomic_compare_exchange_strong(&buffers[i].owner, &expected, 1))
+                        continue;
+
+                pthread_mutex_lock(&buffers[i].lock);
+                buffers[i].thread = atomic_fetch_add(&num_threads, 1) + 1;
+                buffers[i].session = atomic_load(&session);
+                buffers[i].used = 0;
+                pthread_mutex_unlock(&buffers[i].lock);
+                thread_buffer = &buffers[i];
+                pthread_setspecific(buffer_key, thread_buffer);
+                return thread_buffer;
+        }
+        return NULL;
+}
+
+uint32_t rune_binlog_register(int level, const char *fmt) {
+        char sig[MAX_ARGS + 1];
+        int nargs = _parse_format(fmt, sig);
+        if (nargs < 0) {
+                log_output(LOG_WARN, "Format string cannot be logged in binary: %s", fmt);
+                return BINLOG_INVALID_ID;
+        }
+
+        pthread_mutex_lock(&format_lock);
+        uint32_t count = atomic_load(&num_formats);
+        for (uint32_t i = 0; i < count; i++) {
+                if (formats[i].fmt == fmt && formats[i].level == level) {
+                        pthread_mutex_unlock(&format_lock);
+                        return i + 1;
+                }
+        }
+        if (count == MAX_FORMATS) {
+                pthread_mutex_unlock(&format_lock);
+                log_output(LOG_WARN, "Binary log format table is full");
+                return BINLOG_INVALID_ID;
+        }
+
+        size_t max_size = sizeof(binlog_record_t);
+        for (int i = 0; i < nargs; i++)
+                max_size += sig[i] == 's' ? sizeof(uint16_t) + BINLOG_MAX_STRING : sizeof(uint64_t);
+
+        struct binlog_format *format = &formats[count];
+        format->fmt = fmt;
+        format->level = level;
+        format->max_size = max_size;
+        memcpy(format->sig, sig, nargs + 1);
+        atomic_store_explicit(&num_formats, count + 1, memory_order_release);
+
+        pthread_mutex_lock(&file_lock);
+        if (log_file != NULL)
+                _write_format(count + 1);
+        pthread_mutex_unlock(&file_lock);
+        pthread_mutex_unlock(&format_lock);
+        return count + 1;
+}
+
+void rune_binlog_write(uint32_t id, ...) {
+        if (atomic_load_explicit(&active, memory_order_acquire) == 0)
+                return;
+        if (id == BINLOG_FORMAT_ID || id > atomic_load_explicit(&num_formats, memory_order_acquire))
+                return;
+
+        struct binlog_buffer *buf = _thread_buffer();
+        if (buf == NULL) {
+                atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+                return;
+        }
+
+        struct binlog_format *format = &formats[id - 1];
+        pthread_mutex_lock(&buf->lock);
+        uint32_t cur = atomic_load_explicit(&session, memory_order_relaxed);
+        if (buf->session != cur) {
+                buf->session = cur;
+                buf->used = 0;
+        }
+        if (buf->used + format->max_size > BUFFER_SIZE)
+                _flush_buffer(buf);
+
+        unsigned char *start = buf->data + buf->used;
+        unsigned char *out = start + sizeof(binlog_record_t);
+        uint64_t val = 0;
+        double dval;
+        uint16_t len;
+        const char *str;
+        va_list args;
+        va_start(args, id);
+        for (const char *k = format->sig; *k != '\0'; k++) {
+                switch (*k) {
+                        case 'i':
+                                val = (int64_t)va_arg(args, int);
+                                break;
+                        case 'I':
+                                val = va_arg(args, unsigned int);
+                                break;
+                        case 'b':
+                                val = (int64_t)(signed char)va_arg(args, int);
+                                break;
+                        case 'B':
+                                val = (unsigned char)va_arg(args, int);
+                                break;
+                        case 'h':
+                                val = (int64_t)(short)va_arg(args, int);
+                                break;
+                        case 'H':
+                                val = (unsigned short)va_arg(args, int);
+                                break;
+                        case 'l':
+                                val = (int64_t)va_arg(args, long);
+                                break;
+                        case 'L':
+                                val = va_arg(args, unsigned long);
+                                break;
+                        case 'q':
+                                val = va_arg(args, long long);
+                                break;
+                        case 'j':
+                                val = va_arg(args, intmax_t);
+                                break;
+                        case 'z':
+                                val = va_arg(args, size_t);
+                                break;
+                        case 't':
+                                val = va_arg(args, ptrdiff_t);
+                                break;
+                        case 'p':
+                                val = (uintptr_t)va_arg(args, void*);
+                                break;
+                        case 'd':
+                                dval = va_arg(args, double);
+                                memcpy(&val, &dval, sizeof(val));
+                                break;
+                        case 's':
+                                str = va_arg(args, const char*);
+                                if (str == NULL)
+                                        str = "(null)";
+                                len = strnlen(str, BINLOG_MAX_STRING);
+                                memcpy(out, &len, sizeof(len));
+                                memcpy(out + sizeof(len), str, len);
+                                out += sizeof(len) + len;
+                                continue;
+                }
+                memcpy(out, &val, sizeof(val));
+                out += sizeof(val);
+        }
+        va_end(args);
+
+        binlog_record_t record = {
+                .timestamp = futex_clock_ns() - start_ns,
+                .size = out - start,
+                .id = id,
+                .thread = buf->thread,
+                .reserved = 0
+        };
+        memcpy(start, &record, sizeof(record));
+        buf->used += record.size;
+        pthread_mutex_unlock(&buf->lock);
+}
+
+int rune_binlog_active(void) {
+        return atomic_load_explicit(&active, memory_order_relaxed);
+}
+
+void rune_binlog_flush(void) {
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+                if (atomic_load_explicit(&buffers[i].owner, memory_order_acquire) == 0)
+                        continue;
+                pthread_mutex_lock(&buffers[i].lock);
+                _flush_buffer(&buffers[i]);
+                pthread_mutex_unlock(&buffers[i].lock);
+        }
+        pthread_mutex_lock(&file_lock);
+        if (log_file != NULL)
+                fflush(log_file);
+        pthread_mutex_unlock(&file_lock);
+}
+
+int rune_binlog_start(const char *path) {
+        rune_binlog_stop();
+        pthread_once(&key_once, _create_key);
+
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+                log_output(LOG_ERROR, "Cannot open binary log %s", path);
+                return -1;
+        }
+
+        binlog_header_t header = {
+                .magic = BINLOG_MAGIC,
+                .version = BINLOG_VERSION,
+                .record_size = sizeof(binlog_record_t),
+                .reserved = 0
+        };
+        if (fwrite(&header, sizeof(header), 1, file) != 1) {
+                log_output(LOG_ERROR, "Cannot write binary log %s", path);
+                fclose(file);
+                return -1;
+        }
+
+        pthread_mutex_lock(&format_lock);
+        pthread_mutex_lock(&file_lock);
+        log_file = file;
+        start_ns = futex_clock_ns();
+        atomic_fetch_add(&session, 1);
+        uint32_t count = atomic_load(&num_formats);
+        for (uint32_t i = 1; i <= count; i++)
+                _write_format(i);
+        atomic_store(&dropped, 0);
+        atomic_store(&active, 1);
+        pthread_mutex_unlock(&file_lock);
+        pthread_mutex_unlock(&format_lock);
+        log_output(LOG_INFO, "Recording binary log to %s", path);
+        return 0;
+}
+
+void rune_binlog_stop(void) {
+        if (atomic_exchange(&active, 0) == 0)
+                return;
+
+        rune_binlog_flush();
+        pthread_mutex_lock(&file_lock);
+        fclose(log_file);
+        log_file = NULL;
+        pthread_mutex_unlock(&file_lock);
+
+        size_t lost = atomic_load(&dropped);
+        if (lost > 0)
+                log_output(LOG_WARN, "Dropped %zu binary log messages, no buffer was free", lost);
+}
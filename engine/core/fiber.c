@@ -0,0 +1,444 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/core/fiber.h>
+#include <rune/core/logging.h>
+#include "fiber_sched.h"
+#include "futex.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define FIBER_WIN32 1
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__x86_64__) && defined(__ELF__)
+#define FIBER_ASM 1
+#else
+#include <ucontext.h>
+#endif
+#endif
+
+#define MAX_POOLED_FIBERS       128
+#define WAITER_LOCKS            64
+
+#define FIBER_RUNNING           0
+#define FIBER_YIELDED           1
+#define FIBER_WAITING           2
+#define FIBER_DONE              3
+
+/*
+ * A fiber is resumed by running a job that switches from the worker's own
+ * stack onto the fiber stack. When the fiber suspends it switches back to
+ * that job, which decides what happens next based on the fiber's state.
+ * Acting only after the switch guarantees a fiber is never queued, and so
+ * never resumed by another worker, before its context has been saved.
+ *
+ * Each stack is a single mapping: a guard page at the bottom, the usable
+ * stack, and the fiber struct itself in the last page. Finished fibers go
+ * back to a small pool with their mapping intact.
+ *
+ * Windows has no way to hand a stack to a context, so there each fiber is
+ * an OS fiber created with its own guarded stack and the mapping only holds
+ * the struct. Worker threads are converted to fibers the first time they
+ * resume one. An OS fiber cannot be restarted, so its entry point loops and
+ * runs the next function each time a pooled fiber is reused.
+ *
+ * Fibers waiting on a job counter are linked into the counter and guarded
+ * by one of a set of striped spinlocks. Finished jobs and fibers drop their
+ * counter through fiber_counter_release. A decrement that might reach zero
+ * takes the lock and detaches the waiters first, because a thread in
+ * rune_job_wait may return, and take a stack-allocated counter with it, the
+ * moment it sees zero. Nothing touches the counter after that decrement.
+ * Checking the counter and linking a waiter happen under the same lock, so
+ * a wakeup cannot slip in between.
+ */
+#if defined(FIBER_WIN32)
+struct fiber_ctx {
+        void *handle;
+};
+#elif defined(FIBER_ASM)
+struct fiber_ctx {
+        void *sp;
+};
+#else
+struct fiber_ctx {
+        ucontext_t uc;
+};
+#endif
+
+struct rune_fiber {
+        struct fiber_ctx ctx;
+        struct fiber_ctx *caller;
+        fiber_fn_t fn;
+        void *data;
+        job_counter_t *counter;
+        job_counter_t *wait_counter;
+        int state;
+        struct rune_fiber *next;
+        void *stack;
+        void *mapping;
+        size_t mapping_size;
+};
+
+static struct rune_fiber *free_fibers = NULL;
+static int num_free_fibers = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_flag waiter_locks[WAITER_LOCKS];
+static _Thread_local struct rune_fiber *current_fiber = NULL;
+
+#ifdef FIBER_ASM
+void _fiber_swap(void **save_sp, void *next_sp);
+void _fiber_entry(void);
+
+__asm__(
+        ".text\n"
+        ".globl _fiber_swap\n"
+        ".hidden _fiber_swap\n"
+        ".type _fiber_swap,@function\n"
+        ".p2align 4\n"
+        "_fiber_swap:\n"
+        "        pushq %rbp\n"
+        "        pushq %rbx\n"
+        "        pushq %r12\n"
+        "        pushq %r13\n"
+        "        pushq %r14\n"
+        "        pushq %r15\n"
+        "        subq $8, %rsp\n"
+        "        stmxcsr (%rsp)\n"
+        "        fnstcw 4(%rsp)\n"
+        "        movq %rsp, (%rdi)\n"
+        "        movq %rsi, %rsp\n"
+        "        ldmxcsr (%rsp)\n"
+        "        fldcw 4(%rsp)\n"
+        "        addq $8, %rsp\n"
+        "        popq %r15\n"
+        "        popq %r14\n"
+        "        popq %r13\n"
+        "        popq %r12\n"
+        "        popq %rbx\n"
+        "        popq %rbp\n"
+        "        ret\n"
+        ".size _fiber_swap,.-_fiber_swap\n"
+        ".globl _fiber_entry\n"
+        ".hidden _fiber_entry\n"
+        ".type _fiber_entry,@function\n"
+        ".p2align 4\n"
+        "_fiber_entry:\n"
+        "        movq %rbx, %rdi\n"
+        "        andq $-16, %rsp\n"
+        "        call *%r12\n"
+        "        ud2\n"
+        ".size _fiber_entry,.-_fiber_entry\n"
+);
+#endif
+
+static void _fiber_main(struct rune_fiber *fiber) {
+        fiber->fn(fiber->data);
+        fiber->state = FIBER_DONE;
+#if defined(FIBER_WIN32)
+        SwitchToFiber(fiber->caller->handle);
+#elif defined(FIBER_ASM)
+        _fiber_swap(&fiber->ctx.sp, fiber->caller->sp);
+#else
+        swapcontext(&fiber->ctx.uc, &fiber->caller->uc);
+#endif
+}
+
+#if defined(FIBER_WIN32)
+static void WINAPI _fiber_win_entry(void *data) {
+        for (;;)
+                _fiber_main(data);
+}
+#elif !defined(FIBER_ASM)
+static void _fiber_uc_entry(unsigned int hi, unsigned int lo) {
+        _fiber_main((struct rune_fiber*)(((uintptr_t)hi << 32) | (uintptr_t)lo));
+}
+#endif
+
+static int _ctx_init(struct rune_fiber *fiber, void *stack, size_t stack_size) {
+#if defined(FIBER_WIN32)
+        (void)stack;
+        if (fiber->ctx.handle == NULL)
+                fiber->ctx.handle = CreateFiberEx(0, stack_size, 0, _fiber_win_entry, fiber);
+        return fiber->ctx.handle != NULL ? 0 : -1;
+#elif defined(FIBER_ASM)
+        uint64_t *sp = (uint64_t*)(((uintptr_t)stack + stack_size) & ~(uintptr_t)15);
+        sp[-1] = 0;
+        sp[-2] = (uint64_t)(uintptr_t)_fiber_entry;
+        sp[-3] = 0;
+        sp[-4] = (uint64_t)(uintptr_t)fiber;
+        sp[-5] = (uint64_t)(uintptr_t)_fiber_main;
+        sp[-6] = 0;
+        sp[-7] = 0;
+        sp[-8] = 0;
+        sp[-9] = 0x1F80 | ((uint64_t)0x037F << 32);
+        fiber->ctx.sp = &sp[-9];
+        return 0;
+#else
+        getcontext(&fiber->ctx.uc);
+        fiber->ctx.uc.uc_stack.ss_sp = stack;
+        fiber->ctx.uc.uc_stack.ss_size = stack_size;
+        fiber->ctx.uc.uc_link = NULL;
+        uintptr_t ptr = (uintptr_t)fiber;
+        makecontext(&fiber->ctx.uc, (void (*)(void))_fiber_uc_entry, 2,
+                        (unsigned int)(ptr >> 32), (unsigned int)ptr);
+        return 0;
+#endif
+}
+
+static void _ctx_swap(struct fiber_ctx *from, struct fiber_ctx *to) {
+#if defined(FIBER_WIN32)
+        from->handle = GetCurrentFiber();
+        SwitchToFiber(to->handle);
+#elif defined(FIBER_ASM)
+        _fiber_swap(&from->sp, to->sp);
+#else
+        swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+static struct rune_fiber* _alloc_fiber(void) {
+        pthread_mutex_lock(&pool_lock);
+        struct rune_fiber *fiber = free_fibers;
+        if (fiber != NULL) {
+                free_fibers = fiber->next;
+                num_free_fibers--;
+        }
+        pthread_mutex_unlock(&pool_lock);
+        if (fiber != NULL)
+                return fiber;
+
+#ifdef FIBER_WIN32
+        void *mapping = VirtualAlloc(NULL, sizeof(struct rune_fiber), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (mapping == NULL) {
+                log_output(LOG_ERROR, "Cannot allocate fiber");
+                return NULL;
+        }
+
+        fiber = mapping;
+        fiber->ctx.handle = NULL;
+        fiber->stack = NULL;
+        fiber->mapping = mapping;
+        fiber->mapping_size = sizeof(struct rune_fiber);
+#else
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t header = (sizeof(struct rune_fiber) + page - 1) & ~(page - 1);
+        size_t size = page + FIBER_STACK_SIZE + header;
+        void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+                log_output(LOG_ERROR, "Cannot map fiber stack");
+                return NULL;
+        }
+        if (mprotect(mapping, page, PROT_NONE) != 0)
+                log_output(LOG_WARN, "Cannot protect fiber stack guard page");
+
+        fiber = (struct rune_fiber*)((uint8_t*)mapping + size - header);
+        fiber->stack = (uint8_t*)mapping + page;
+        fiber->mapping = mapping;
+        fiber->mapping_size = size;
+#endif
+        return fiber;
+}
+
+static void _unmap_fiber(struct rune_fiber *fiber) {
+#ifdef FIBER_WIN32
+        if (fiber->ctx.handle != NULL)
+                DeleteFiber(fiber->ctx.handle);
+        VirtualFree(fiber->mapping, 0, MEM_RELEASE);
+#else
+        munmap(fiber->mapping, fiber->mapping_size);
+#endif
+}
+
+static void _free_fiber(struct rune_fiber *fiber) {
+        pthread_mutex_lock(&pool_lock);
+        if (num_free_fibers < MAX_POOLED_FIBERS) {
+                fiber->next = free_fibers;
+                free_fibers = fiber;
+                num_free_fibers++;
+                fiber = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+        if (fiber != NULL)
+                _unmap_fiber(fiber);
+}
+
+void fiber_release_stacks(void) {
+        pthread_mutex_lock(&pool_lock);
+        struct rune_fiber *fiber = free_fibers;
+        free_fibers = NULL;
+        num_free_fibers = 0;
+        pthread_mutex_unlock(&pool_lock);
+
+        struct rune_fiber *next;
+        for (; fiber != NULL; fiber = next) {
+                next = fiber->next;
+                _unmap_fiber(fiber);
+        }
+}
+
+static atomic_flag* _waiter_lock(job_counter_t *counter) {
+        atomic_flag *lock = &waiter_locks[((uintptr_t)counter >> 6) % WAITER_LOCKS];
+        while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+                cpu_relax();
+        return lock;
+}
+
+static void _fiber_job(void *data);
+
+static void _resume_later(struct rune_fiber *fiber) {
+        job_decl_t job;
+        job.fn = _fiber_job;
+        job.data = fiber;
+        rune_job_run(&job, 1, NULL);
+}
+
+void fiber_counter_release(job_counter_t *counter) {
+        int value = atomic_load_explicit(&counter->value, memory_order_relaxed);
+        while (value > 1) {
+                if (atomic_compare_exchange_weak_explicit(&counter->value, &value, value - 1,
+                                        memory_order_release, memory_order_relaxed))
+                        return;
+        }
+
+        atomic_flag *lock = _waiter_lock(counter);
+        struct rune_fiber *fiber = counter->waiters;
+        counter->waiters = NULL;
+        if (atomic_fetch_sub_explicit(&counter->value, 1, memory_order_release) != 1) {
+                counter->waiters = fiber;
+                fiber = NULL;
+        }
+        atomic_flag_clear_explicit(lock, memory_order_release);
+
+        struct rune_fiber *next;
+        for (; fiber != NULL; fiber = next) {
+                next = fiber->next;
+                _resume_later(fiber);
+        }
+}
+
+static void _finish_fiber(struct rune_fiber *fiber) {
+        job_counter_t *counter = fiber->counter;
+        _free_fiber(fiber);
+        if (counter != NULL)
+                fiber_counter_release(counter);
+}
+
+static void _park_fiber(struct rune_fiber *fiber) {
+        job_counter_t *counter = fiber->wait_counter;
+        atomic_flag *lock = _waiter_lock(counter);
+        if (atomic_load_explicit(&counter->value, memory_order_acquire) <= 0) {
+                atomic_flag_clear_explicit(lock, memory_order_release);
+                _resume_later(fiber);
+                return;
+        }
+        fiber->next = counter->waiters;
+        counter->waiters = fiber;
+        atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+static void _fiber_job(void *data) {
+        struct rune_fiber *fiber = data;
+        struct rune_fiber *prev = current_fiber;
+        struct fiber_ctx sched;
+#ifdef FIBER_WIN32
+        if (!IsThreadAFiber() && ConvertThreadToFiber(NULL) == NULL) {
+                log_output(LOG_ERROR, "Cannot convert worker thread to a fiber");
+                _finish_fiber(fiber);
+                return;
+        }
+#endif
+        fiber->caller = &sched;
+        fiber->state = FIBER_RUNNING;
+        current_fiber = fiber;
+        _ctx_swap(&sched, &fiber->ctx);
+        current_fiber = prev;
+
+        switch (fiber->state) {
+        case FIBER_DONE:
+                _finish_fiber(fiber);
+                break;
+        case FIBER_YIELDED:
+                job_run_deferred(_fiber_job, fiber);
+                break;
+        case FIBER_WAITING:
+                _park_fiber(fiber);
+                break;
+        }
+}
+
+__attribute__((noinline)) static struct rune_fiber* _current(void) {
+        return current_fiber;
+}
+
+int rune_fiber_run(fiber_fn_t fn, void *data, job_counter_t *counter) {
+        struct rune_fiber *fiber = _alloc_fiber();
+        if (fiber == NULL)
+                return -1;
+
+        fiber->fn = fn;
+        fiber->data = data;
+        fiber->counter = counter;
+        fiber->wait_counter = NULL;
+        fiber->next = NULL;
+        if (_ctx_init(fiber, fiber->stack, FIBER_STACK_SIZE) != 0) {
+                log_output(LOG_ERROR, "Cannot create fiber");
+                _free_fiber(fiber);
+                return -1;
+        }
+        if (counter != NULL)
+                atomic_fetch_add_explicit(&counter->value, 1, memory_order_relaxed);
+        _resume_later(fiber);
+        return 0;
+}
+
+void rune_fiber_yield(void) {
+        struct rune_fiber *fiber = _current();
+        if (fiber == NULL) {
+                sched_yield();
+                return;
+        }
+
+        fiber->state = FIBER_YIELDED;
+        _ctx_swap(&fiber->ctx, fiber->caller);
+}
+
+void rune_fiber_wait(job_counter_t *counter) {
+        struct rune_fiber *fiber = _current();
+        if (fiber == NULL) {
+                rune_job_wait(counter);
+                return;
+        }
+
+        while (atomic_load_explicit(&counter->value, memory_order_acquire) > 0) {
+                fiber->state = FIBER_WAITING;
+                fiber->wait_counter = counter;
+                _ctx_swap(&fiber->ctx, fiber->caller);
+        }
+}
+
+int rune_fiber_active(void) {
+        return _current() != NULL;
+}
@@ -0,0 +1,108 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <sched.h>
+#include <time.h>
+#endif
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ volatile("yield");
+#endif
+}
+
+/*
+ * Blocks while *addr == expected, until woken or timeout_ns nanoseconds
+ * pass. A negative timeout waits forever. Returns -1 on timeout and 0
+ * otherwise; spurious wakeups are possible, callers must recheck.
+ */
+static inline int futex_wait(atomic_int *addr, int expected, int64_t timeout_ns) {
+#if defined(__linux__)
+        struct timespec ts;
+        struct timespec *tsp = NULL;
+        if (timeout_ns >= 0) {
+                ts.tv_sec = timeout_ns / 1000000000;
+                ts.tv_nsec = timeout_ns % 1000000000;
+                tsp = &ts;
+        }
+        if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, tsp, NULL, 0) == -1
+                        && timeout_ns >= 0 && errno == ETIMEDOUT)
+                return -1;
+        return 0;
+#elif defined(_WIN32)
+        DWORD ms = timeout_ns < 0 ? INFINITE : (DWORD)(timeout_ns / 1000000);
+        if (!WaitOnAddress((volatile void*)addr, &expected, sizeof(expected), ms))
+                return GetLastError() == ERROR_TIMEOUT ? -1 : 0;
+        return 0;
+#else
+        (void)timeout_ns;
+        if (atomic_load(addr) == expected)
+                sched_yield();
+        return 0;
+#endif
+}
+
+/*
+ * Monotonic clock in nanoseconds, used to turn absolute deadlines back into
+ * the relative timeouts futex_wait expects.
+ */
+static inline int64_t futex_clock_ns(void) {
+#if defined(_WIN32)
+        return (int64_t)GetTickCount64() * 1000000;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void futex_wake(atomic_int *addr, int count) {
+#if defined(__linux__)
+        syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#elif defined(_WIN32)
+        if (count == 1)
+                WakeByAddressSingle((void*)addr);
+        else
+                WakeByAddressAll((void*)addr);
+#else
+        (void)addr;
+        (void)count;
+#endif
+}
+
+#endif
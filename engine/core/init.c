@@ -22,6 +22,7 @@
 #include <rune/core/init.h>
 #include <rune/core/abort.h>
 #include <rune/core/alloc.h>
+#include <rune/core/binlog.h>
 #include <rune/core/config.h>
 #include <rune/core/logging.h>
 #include <rune/core/thread.h>
@@ -32,7 +33,10 @@ int rune_init(int argc, char* argv[]) {
         log_output(LOG_INFO, "Started Rune Engine version %s", RUNE_VER);
 
         rune_init_default_settings();
+        if (rune_get_log_async() == 1)
+                rune_log_start_async();
         rune_init_thread_api();
+        rune_job_init(0);
 
         rune_load_mods();
         rune_init_mods();
@@ -44,5 +48,10 @@ void rune_exit(void) {
         log_output(LOG_INFO, "Engine shutdown requested");
         rune_clear_objs();
         rune_close_mods();
+        rune_job_close();
+        rune_binlog_stop();
+        rune_log_stop_async();
+        rune_log_close_sinks();
+        rune_close_thread_api();
         rune_free_all();
 }
@@ -0,0 +1,369 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/core/thread.h>
+#include <rune/core/logging.h>
+#include <rune/core/alloc.h>
+#include "fiber_sched.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#define DEQUE_SIZE      4096
+#define INJECT_SIZE     4096
+#define MAX_WORKERS     64
+#define SPIN_COUNT      64
+#define CACHE_LINE      64
+
+/*
+ * Every worker owns a fixed-size Chase-Lev deque. The owner pushes and pops
+ * at the bottom without locking, while idle workers steal from the top with
+ * a single CAS. Slots are atomics because a stalled thief may still be
+ * reading a slot the owner has since reused; its CAS then fails and the stale
+ * copy is discarded. Threads that are not workers queue jobs through a shared,
+ * mutex-protected ring instead; fibers that yield are requeued there as
+ * well, so they resume only after the worker's local jobs. Workers with
+ * nothing to run or steal spin briefly and then sleep until new jobs are
+ * queued.
+ */
+
+struct job {
+        job_fn_t fn;
+        void *data;
+        job_counter_t *counter;
+};
+
+struct slot {
+        _Atomic(job_fn_t) fn;
+        _Atomic(void*) data;
+        _Atomic(job_counter_t*) counter;
+};
+
+struct deque {
+        _Alignas(CACHE_LINE) _Atomic int64_t top;
+        _Alignas(CACHE_LINE) _Atomic int64_t bottom;
+        struct slot slots[DEQUE_SIZE];
+};
+
+struct worker {
+        struct deque deque;
+        int thread_id;
+        uint32_t seed;
+};
+
+static struct worker *workers = NULL;
+static int num_workers = 0;
+static atomic_int running = 0;
+static atomic_int pending = 0;
+static atomic_int sleeping = 0;
+static _Thread_local int worker_index = -1;
+
+static struct job inject[INJECT_SIZE];
+static size_t inject_head = 0;
+static size_t inject_count = 0;
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+
+static inline void _slot_store(struct slot *slot, const struct job *job) {
+        atomic_store_explicit(&slot->fn, job->fn, memory_order_relaxed);
+        atomic_store_explicit(&slot->data, job->data, memory_order_relaxed);
+        atomic_store_explicit(&slot->counter, job->counter, memory_order_relaxed);
+}
+
+static inline void _slot_load(struct slot *slot, struct job *job) {
+        job->fn = atomic_load_explicit(&slot->fn, memory_order_relaxed);
+        job->data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+        job->counter = atomic_load_explicit(&slot->counter, memory_order_relaxed);
+}
+
+static int _deque_push(struct deque *deque, const struct job *job) {
+        int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+        int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+        if (b - t >= DEQUE_SIZE)
+                return -1;
+
+        _slot_store(&deque->slots[b & (DEQUE_SIZE - 1)], job);
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_release);
+        return 0;
+}
+
+static int _deque_pop(struct deque *deque, struct job *job) {
+        int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+        atomic_store_explicit(&deque->bottom, b, memory_order_seq_cst);
+        int64_t t = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+        if (t > b) {
+                atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+                return -1;
+        }
+
+        _slot_load(&deque->slots[b & (DEQUE_SIZE - 1)], job);
+        if (t < b)
+                return 0;
+
+        int ret = 0;
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                memory_order_seq_cst, memory_order_relaxed))
+                ret = -1;
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return ret;
+}
+
+static int _deque_steal(struct deque *deque, struct job *job) {
+        int64_t t = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+        int64_t b = atomic_load_explicit(&deque->bottom, memory_order_seq_cst);
+        if (t >= b)
+                return -1;
+
+        _slot_load(&deque->slots[t & (DEQUE_SIZE - 1)], job);
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                memory_order_seq_cst, memory_order_relaxed))
+                return -1;
+        return 0;
+}
+
+static int _inject_push(const struct job *job) {
+        pthread_mutex_lock(&inject_lock);
+        if (inject_count == INJECT_SIZE) {
+                pthread_mutex_unlock(&inject_lock);
+                return -1;
+        }
+        inject[(inject_head + inject_count++) & (INJECT_SIZE - 1)] = *job;
+        pthread_mutex_unlock(&inject_lock);
+        return 0;
+}
+
+static int _inject_pop(struct job *job) {
+        pthread_mutex_lock(&inject_lock);
+        if (inject_count == 0) {
+                pthread_mutex_unlock(&inject_lock);
+                return -1;
+        }
+        *job = inject[inject_head];
+        inject_head = (inject_head + 1) & (INJECT_SIZE - 1);
+        inject_count--;
+        pthread_mutex_unlock(&inject_lock);
+        return 0;
+}
+
+static int _next_job(struct job *job) {
+        int self = worker_index;
+        if (self >= 0 && _deque_pop(&workers[self].deque, job) == 0)
+                goto found;
+        if (_inject_pop(job) == 0)
+                goto found;
+
+        uint32_t seed = self >= 0 ? workers[self].seed : (uint32_t)(uintptr_t)job;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        if (self >= 0)
+                workers[self].seed = seed;
+
+        int victim;
+        for (int i = 0; i < num_workers; i++) {
+                victim = (seed + i) % num_workers;
+                if (victim != self && _deque_steal(&workers[victim].deque, job) == 0)
+                        goto found;
+        }
+        return -1;
+
+found:
+        atomic_fetch_sub_explicit(&pending, 1, memory_order_relaxed);
+        return 0;
+}
+
+static void _run_job(struct job *job) {
+        job->fn(job->data);
+        if (job->counter != NULL)
+                fiber_counter_release(job->counter);
+}
+
+static void _wake_workers(int count) {
+        atomic_fetch_add(&pending, count);
+        if (atomic_load(&sleeping) == 0)
+                return;
+
+        pthread_mutex_lock(&sleep_lock);
+        if (count == 1)
+                pthread_cond_signal(&sleep_cond);
+        else
+                pthread_cond_broadcast(&sleep_cond);
+        pthread_mutex_unlock(&sleep_lock);
+}
+
+static void _worker_sleep(void) {
+        pthread_mutex_lock(&sleep_lock);
+        atomic_fetch_add(&sleeping, 1);
+        while (atomic_load(&pending) <= 0 && atomic_load(&running) == 1)
+                pthread_cond_wait(&sleep_cond, &sleep_lock);
+        atomic_fetch_sub(&sleeping, 1);
+        pthread_mutex_unlock(&sleep_lock);
+}
+
+static void* _worker_main(void *data) {
+        worker_index = (int)(intptr_t)data;
+        struct job job;
+        int spins = 0;
+        while (atomic_load_explicit(&running, memory_order_relaxed) == 1) {
+                if (_next_job(&job) == 0) {
+                        _run_job(&job);
+                        spins = 0;
+                } else if (++spins < SPIN_COUNT) {
+                        sched_yield();
+                } else {
+                        _worker_sleep();
+                        spins = 0;
+                }
+        }
+        worker_index = -1;
+        return NULL;
+}
+
+static void _place_worker(int index, int pin) {
+        char name[16];
+        snprintf(name, sizeof(name), "rune-worker-%d", index);
+        rune_thread_set_name(workers[index].thread_id, name);
+        if (pin == 0)
+                return;
+
+        const cpu_topology_t *topology = rune_cpu_topology();
+        int cpus[topology->num_cpus];
+        int count = 0;
+        for (int i = 0; i < topology->num_cpus; i++) {
+                if (topology->cpus[i].core == index)
+                        cpus[count++] = topology->cpus[i].id;
+        }
+        rune_thread_set_affinity(workers[index].thread_id, cpus, count);
+}
+
+int rune_job_init(int count) {
+        if (workers != NULL)
+                return 0;
+
+        const cpu_topology_t *topology = rune_cpu_topology();
+        if (count <= 0)
+                count = topology->num_cores;
+        if (count <= 0)
+                count = 1;
+        if (count > MAX_WORKERS)
+                count = MAX_WORKERS;
+
+        workers = rune_alloc_aligned_tagged(sizeof(struct worker) * count, CACHE_LINE, MEM_TAG_THREAD);
+        if (workers == NULL)
+                return -1;
+
+        for (int i = 0; i < count; i++) {
+                atomic_init(&workers[i].deque.top, 0);
+                atomic_init(&workers[i].deque.bottom, 0);
+                workers[i].thread_id = -1;
+                workers[i].seed = 2654435761U * (i + 1);
+        }
+
+        num_workers = count;
+        worker_index = 0;
+        atomic_store(&running, 1);
+        for (int i = 1; i < count; i++) {
+                workers[i].thread_id = rune_thread_init(_worker_main, (void*)(intptr_t)i, 0);
+                if (workers[i].thread_id == -1) {
+                        log_output(LOG_ERROR, "Cannot start job worker %d", i);
+                        rune_job_close();
+                        return -1;
+                }
+                _place_worker(i, count <= topology->num_cores);
+        }
+        log_output(LOG_INFO, "Started job system with %d workers", count);
+        return 0;
+}
+
+void rune_job_close(void) {
+        if (workers == NULL)
+                return;
+
+        pthread_mutex_lock(&sleep_lock);
+        atomic_store(&running, 0);
+        pthread_cond_broadcast(&sleep_cond);
+        pthread_mutex_unlock(&sleep_lock);
+        for (int i = 1; i < num_workers; i++) {
+                if (workers[i].thread_id != -1)
+                        rune_thread_join(workers[i].thread_id, NULL);
+        }
+
+        rune_free(workers);
+        fiber_release_stacks();
+        workers = NULL;
+        num_workers = 0;
+        worker_index = -1;
+        atomic_store(&pending, 0);
+}
+
+void rune_job_run(const job_decl_t *jobs, int count, job_counter_t *counter) {
+        if (counter != NULL)
+                atomic_fetch_add_explicit(&counter->value, count, memory_order_relaxed);
+
+        struct job job;
+        int queued = 0;
+        int running_now = atomic_load_explicit(&running, memory_order_relaxed);
+        for (int i = 0; i < count; i++) {
+                job.fn = jobs[i].fn;
+                job.data = jobs[i].data;
+                job.counter = counter;
+                if (running_now == 1 && worker_index >= 0 && _deque_push(&workers[worker_index].deque, &job) == 0)
+                        queued++;
+                else if (running_now == 1 && worker_index < 0 && _inject_push(&job) == 0)
+                        queued++;
+                else
+                        _run_job(&job);
+        }
+
+        if (queued > 0)
+                _wake_workers(queued);
+}
+
+void job_run_deferred(job_fn_t fn, void *data) {
+        struct job job;
+        job.fn = fn;
+        job.data = data;
+        job.counter = NULL;
+        if (atomic_load_explicit(&running, memory_order_relaxed) == 1 && _inject_push(&job) == 0)
+                _wake_workers(1);
+        else
+                _run_job(&job);
+}
+
+void rune_job_wait(job_counter_t *counter) {
+        struct job job;
+        while (atomic_load_explicit(&counter->value, memory_order_acquire) > 0) {
+                if (atomic_load_explicit(&running, memory_order_relaxed) == 1 && _next_job(&job) == 0)
+                        _run_job(&job);
+                else
+                        sched_yield();
+        }
+}
+
+int rune_job_num_workers(void) {
+        return num_workers;
+}
+
+int rune_job_worker_index(void) {
+        return worker_index;
+}
@@ -21,6 +21,10 @@
 
 #include <rune/core/logging.h>
 #include <rune/core/config.h>
+#include <rune/util/queue.h>
+#include "futex.h"
+#include <pthread.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
@@ -38,56 +42,450 @@
 #define LSTR_INFO       "[INFO]"
 #define LSTR_DEBUG      "[DEBUG]"
 
-static int debug_enabled = 0;
-static int color_enabled = 0;
+#define MAX_MSG_LEN     4096
+#define RECORD_MSG_LEN  504
+#define RING_SIZE       128
+#define MAX_RINGS       64
+#define WRITER_SLEEP_NS 100000000
+#define FLUSH_TIMEOUT_NS 1000000000
+#define MAX_SINKS       8
 
-void log_output(int level, const char *fmt, ...) {
-        char out[4096];
-        memset(out, 0, sizeof(out));
+/*
+ * In async mode every thread formats its message into a fixed-size record
+ * and pushes it onto its own SPSC ring, so logging costs a vsnprintf and a
+ * copy with no locks or I/O. A background writer drains all rings. When a
+ * ring is full the record is dropped and counted, and the writer reports
+ * the losses, which keeps memory bounded no matter how hard a thread logs.
+ *
+ * Rings live in static storage rather than coming from rune_alloc, because
+ * the allocator logs too. A thread claims a ring on its first message and
+ * gives it back when it exits; threads beyond MAX_RINGS log synchronously.
+ * Fatal messages and rune_log_flush wait for the writer to drain every
+ * ring before returning.
+ */
+struct log_record {
+        int level;
+        char msg[RECORD_MSG_LEN];
+};
 
-        debug_enabled = rune_get_log_debug();
-        color_enabled = rune_get_log_color();
+struct log_ring {
+        spsc_queue_t queue;
+        atomic_int owner;
+        atomic_size_t dropped;
+        struct log_record records[RING_SIZE];
+};
 
-        va_list arg_ptr;
-        va_start(arg_ptr, fmt);
-        vsnprintf(out, 4096, fmt, arg_ptr);
-        va_end(arg_ptr);
+/*
+ * Rate limit state lives with each call site, so an allowed message costs a
+ * clock read and an atomic add on that site's counters. A site whose first
+ * message of an interval is dropped links itself into pending_limits. The
+ * writer walks that list about every WRITER_SLEEP_NS and reports sites
+ * whose interval is over, and rune_log_flush reports all of them, so a
+ * summary is not lost when the site goes quiet.
+ */
+
+static atomic_int debug_enabled = 0;
+static atomic_int color_enabled = 0;
 
-        char *lvl_str;
+static struct log_ring rings[MAX_RINGS];
+static atomic_int num_rings = 0;
+static _Thread_local struct log_ring *thread_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_t writer;
+static atomic_int async_enabled = 0;
+static atomic_int writer_running = 0;
+static atomic_int writer_sleeping = 0;
+static atomic_int wake_seq = 0;
+static atomic_int flush_req = 0;
+static atomic_int flush_done = 0;
+
+static log_ratelimit_t *pending_limits = NULL;
+static pthread_mutex_t ratelimit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _write_stdout(log_sink_t *sink, int level, const char *line, size_t len) {
         char *color = COLOR_NONE;
+        if (color_enabled == 0) {
+                fwrite(line, 1, len, stdout);
+                return;
+        }
+
+        switch (level) {
+                case LOG_FATAL:
+                case LOG_ERROR:
+                        color = COLOR_RED;
+                        break;
+                case LOG_WARN:
+                        color = COLOR_YELLOW;
+                        break;
+                case LOG_DEBUG:
+                        color = COLOR_GREEN;
+                        break;
+        }
+        printf("%s%.*s" COLOR_DEFAULT, color, (int)len, line);
+}
+
+static void _flush_stdout(log_sink_t *sink) {
+        fflush(stdout);
+}
+
+static log_sink_t stdout_sink = {
+        .write = _write_stdout,
+        .flush = _flush_stdout,
+        .close = NULL,
+        .data = NULL
+};
+
+static log_sink_t *sinks[MAX_SINKS] = { &stdout_sink };
+static int num_sinks = 1;
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _write_record(int level, const char *msg) {
+        char *lvl_str = LSTR_INFO;
         switch (level) {
                 case LOG_FATAL:
-                        if (color_enabled == 1)
-                                color = COLOR_RED;
                         lvl_str = LSTR_FATAL;
                         break;
                 case LOG_ERROR:
-                        if (color_enabled == 1)
-                                color = COLOR_RED;
                         lvl_str = LSTR_ERROR;
                         break;
                 case LOG_WARN:
-                        if (color_enabled == 1)
-                                color = COLOR_YELLOW;
                         lvl_str = LSTR_WARN;
                         break;
                 case LOG_INFO:
                         lvl_str = LSTR_INFO;
                         break;
                 case LOG_DEBUG:
-                        if (color_enabled == 1)
-                                color = COLOR_GREEN;
-                        if (debug_enabled == 0)
-                                return;
                         lvl_str = LSTR_DEBUG;
                         break;
         }
 
-        if (color_enabled == 0) {
-                printf("%s %s\n", lvl_str, out);
-        } else {
-                printf("%s%s %s\n", color, lvl_str, out);
-                printf(COLOR_DEFAULT);
+        char line[MAX_MSG_LEN + 16];
+        int len = snprintf(line, sizeof(line), "%s %s\n", lvl_str, msg);
+        if (len >= (int)sizeof(line)) {
+                len = sizeof(line) - 1;
+                line[len - 1] = '\n';
+        }
+
+        pthread_mutex_lock(&sink_lock);
+        for (int i = 0; i < num_sinks; i++)
+                sinks[i]->write(sinks[i], level, line, len);
+        pthread_mutex_unlock(&sink_lock);
+}
+
+static void _flush_sinks(void) {
+        pthread_mutex_lock(&sink_lock);
+        for (int i = 0; i < num_sinks; i++) {
+                if (sinks[i]->flush != NULL)
+                        sinks[i]->flush(sinks[i]);
+        }
+        pthread_mutex_unlock(&sink_lock);
+}
+
+static void _release_ring(void *arg) {
+        struct log_ring *ring = arg;
+        atomic_store_explicit(&ring->owner, 0, memory_order_release);
+}
+
+static struct log_ring* _thread_ring(void) {
+        if (thread_ring != NULL)
+                return thread_ring;
+
+        int expected, count;
+        for (int i = 0; i < MAX_RINGS; i++) {
+                expected = 0;
+                if (!atomic_compare_exchange_strong(&rings[i].owner, &expected, 1))
+                        continue;
+
+                count = atomic_load(&num_rings);
+                while (count <= i && !atomic_compare_exchange_weak(&num_rings, &count, i + 1))
+                        ;
+                thread_ring = &rings[i];
+                pthread_setspecific(ring_key, thread_ring);
+                return thread_ring;
+        }
+        return NULL;
+}
+
+static int _drain_rings(void) {
+        struct log_record record;
+        size_t dropped;
+        int drained = 0;
+        int count = atomic_load(&num_rings);
+        for (int i = 0; i < count; i++) {
+                while (spsc_queue_pop(&rings[i].queue, &record) == 0) {
+                        _write_record(record.level, record.msg);
+                        drained++;
+                }
+                dropped = atomic_exchange_explicit(&rings[i].dropped, 0, memory_order_relaxed);
+                if (dropped > 0) {
+                        snprintf(record.msg, sizeof(record.msg), "Dropped %zu log messages, ring was full", dropped);
+                        _write_record(LOG_WARN, record.msg);
+                }
+        }
+        if (drained > 0)
+                _flush_sinks();
+        return drained;
+}
+
+static int _rings_empty(void) {
+        int count = atomic_load(&num_rings);
+        for (int i = 0; i < count; i++) {
+                if (spsc_queue_size(&rings[i].queue) > 0)
+                        return 0;
+        }
+        return 1;
+}
+
+static void _wake_writer(void) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&writer_sleeping) == 1) {
+                atomic_fetch_add(&wake_seq, 1);
+                futex_wake(&wake_seq, 1);
+        }
+}
+
+static void _flush_ratelimits(int force) {
+        log_ratelimit_t **link;
+        log_ratelimit_t *limit;
+        int64_t now = futex_clock_ns();
+        int64_t start;
+        int suppressed;
+
+        pthread_mutex_lock(&ratelimit_lock);
+        link = &pending_limits;
+        while ((limit = *link) != NULL) {
+                start = atomic_load_explicit(&limit->start, memory_order_relaxed);
+                if (force == 0 && now - start < (int64_t)limit->interval * 1000000) {
+                        link = &limit->next;
+                        continue;
+                }
+
+                *link = limit->next;
+                limit->pending = 0;
+                suppressed = atomic_exchange_explicit(&limit->suppressed, 0, memory_order_relaxed);
+                if (suppressed > 0)
+                        log_output(limit->level == LOG_FATAL ? LOG_ERROR : limit->level,
+                                        "Suppressed %d repeats of a message from %s:%d",
+                                        suppressed, limit->file, limit->line);
+        }
+        pthread_mutex_unlock(&ratelimit_lock);
+}
+
+static void* _writer_main(void *arg) {
+        int seq, req;
+        int64_t now;
+        int64_t last_check = 0;
+        while (atomic_load(&writer_running) == 1) {
+                now = futex_clock_ns();
+                if (now - last_check >= WRITER_SLEEP_NS) {
+                        _flush_ratelimits(0);
+                        last_check = now;
+                }
+                req = atomic_load(&flush_req);
+                if (_drain_rings() > 0)
+                        continue;
+
+                if (atomic_load(&flush_done) != req) {
+                        atomic_store(&flush_done, req);
+                        futex_wake(&flush_done, INT_MAX);
+                }
+                seq = atomic_load(&wake_seq);
+                atomic_store(&writer_sleeping, 1);
+                if (_rings_empty() && atomic_load(&flush_req) == req)
+                        futex_wait(&wake_seq, seq, WRITER_SLEEP_NS);
+                atomic_store(&writer_sleeping, 0);
+        }
+        return NULL;
+}
+
+static int _push_record(int level, const char *fmt, va_list args) {
+        struct log_ring *ring = _thread_ring();
+        if (ring == NULL)
+                return -1;
+
+        struct log_record record;
+        record.level = level;
+        vsnprintf(record.msg, sizeof(record.msg), fmt, args);
+        if (spsc_queue_push(&ring->queue, &record) != 0)
+                atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        else
+                _wake_writer();
+        return 0;
+}
+
+int rune_log_ratelimit(log_ratelimit_t *limit, int level, const char *file, int line, int burst, int interval) {
+        int64_t now = futex_clock_ns();
+        int64_t start = atomic_load_explicit(&limit->start, memory_order_relaxed);
+        if ((start == 0 || now - start >= (int64_t)interval * 1000000)
+                        && atomic_compare_exchange_strong_explicit(&limit->start, &start, now,
+                                memory_order_relaxed, memory_order_relaxed)) {
+                atomic_store_explicit(&limit->count, 1, memory_order_relaxed);
+                int suppressed = atomic_exchange_explicit(&limit->suppressed, 0, memory_order_relaxed);
+                if (suppressed > 0)
+                        log_output(level, "Suppressed %d repeats of a message from %s:%d", suppressed, file, line);
+                return 1;
+        }
+
+        if (atomic_load_explicit(&limit->count, memory_order_relaxed) < burst
+                        && atomic_fetch_add_explicit(&limit->count, 1, memory_order_relaxed) < burst)
+                return 1;
+
+        if (atomic_fetch_add_explicit(&limit->suppressed, 1, memory_order_relaxed) == 0) {
+                pthread_mutex_lock(&ratelimit_lock);
+                if (limit->pending == 0) {
+                        limit->pending = 1;
+                        limit->level = level;
+                        limit->interval = interval;
+                        limit->file = file;
+                        limit->line = line;
+                        limit->next = pending_limits;
+                        pending_limits = limit;
+                }
+                pthread_mutex_unlock(&ratelimit_lock);
+        }
+        return 0;
+}
+
+int rune_log_enabled(int level) {
+        if (level > RUNE_MIN_LOG_LEVEL)
+                return 0;
+        if (level < LOG_DEBUG)
+                return 1;
+        debug_enabled = rune_get_log_debug();
+        return debug_enabled;
+}
+
+void log_output(int level, const char *fmt, ...) {
+        if (rune_log_enabled(level) == 0)
+                return;
+        color_enabled = rune_get_log_color();
+
+        va_list arg_ptr;
+        if (atomic_load_explicit(&async_enabled, memory_order_acquire) == 1 && level != LOG_FATAL) {
+                va_start(arg_ptr, fmt);
+                int ret = _push_record(level, fmt, arg_ptr);
+                va_end(arg_ptr);
+                if (ret == 0)
+                        return;
+        }
+
+        if (level == LOG_FATAL)
+                rune_log_flush();
+
+        char out[MAX_MSG_LEN];
+        va_start(arg_ptr, fmt);
+        vsnprintf(out, sizeof(out), fmt, arg_ptr);
+        va_end(arg_ptr);
+        _write_record(level, out);
+}
+
+int rune_log_start_async(void) {
+        if (atomic_load(&async_enabled) == 1)
+                return 0;
+
+        static int key_created = 0;
+        if (key_created == 0) {
+                if (pthread_key_create(&ring_key, _release_ring) != 0)
+                        return -1;
+                key_created = 1;
+        }
+        for (int i = 0; i < MAX_RINGS; i++) {
+                spsc_queue_init(&rings[i].queue, rings[i].records, RING_SIZE, sizeof(struct log_record));
+                atomic_store(&rings[i].dropped, 0);
+        }
+
+        atomic_store(&writer_running, 1);
+        if (pthread_create(&writer, NULL, _writer_main, NULL) != 0) {
+                atomic_store(&writer_running, 0);
+                log_output(LOG_ERROR, "Cannot start log writer thread");
+                return -1;
+        }
+        atomic_store_explicit(&async_enabled, 1, memory_order_release);
+        return 0;
+}
+
+void rune_log_stop_async(void) {
+        if (atomic_exchange(&async_enabled, 0) == 0)
+                return;
+
+        atomic_store(&writer_running, 0);
+        atomic_fetch_add(&wake_seq, 1);
+        futex_wake(&wake_seq, 1);
+        pthread_join(writer, NULL);
+        _drain_rings();
+}
+
+void rune_log_flush(void) {
+        _flush_ratelimits(1);
+        if (atomic_load(&writer_running) == 0 || pthread_equal(pthread_self(), writer)) {
+                _flush_sinks();
+                return;
+        }
+
+        int req = atomic_fetch_add(&flush_req, 1) + 1;
+        atomic_fetch_add(&wake_seq, 1);
+        futex_wake(&wake_seq, 1);
+
+        int64_t deadline = futex_clock_ns() + FLUSH_TIMEOUT_NS;
+        int done = atomic_load(&flush_done);
+        while (done - req < 0) {
+                int64_t left = deadline - futex_clock_ns();
+                if (left <= 0)
+                        break;
+                futex_wait(&flush_done, done, left);
+                done = atomic_load(&flush_done);
+        }
+        _flush_sinks();
+}
+
+log_sink_t* rune_log_stdout_sink(void) {
+        return &stdout_sink;
+}
+
+int rune_log_add_sink(log_sink_t *sink) {
+        pthread_mutex_lock(&sink_lock);
+        if (num_sinks == MAX_SINKS) {
+                pthread_mutex_unlock(&sink_lock);
+                log_output(LOG_ERROR, "Cannot add log sink, limit of %d reached", MAX_SINKS);
+                return -1;
+        }
+        sinks[num_sinks++] = sink;
+        pthread_mutex_unlock(&sink_lock);
+        return 0;
+}
+
+void rune_log_remove_sink(log_sink_t *sink) {
+        rune_log_flush();
+        pthread_mutex_lock(&sink_lock);
+        for (int i = 0; i < num_sinks; i++) {
+                if (sinks[i] != sink)
+                        continue;
+                sinks[i] = sinks[--num_sinks];
+                pthread_mutex_unlock(&sink_lock);
+                if (sink->flush != NULL)
+                        sink->flush(sink);
+                if (sink->close != NULL)
+                        sink->close(sink);
+                return;
+        }
+        pthread_mutex_unlock(&sink_lock);
+}
+
+void rune_log_close_sinks(void) {
+        rune_log_flush();
+        pthread_mutex_lock(&sink_lock);
+        int count = num_sinks;
+        log_sink_t *closing[MAX_SINKS];
+        memcpy(closing, sinks, sizeof(closing));
+        sinks[0] = &stdout_sink;
+        num_sinks = 1;
+        pthread_mutex_unlock(&sink_lock);
+
+        for (int i = 0; i < count; i++) {
+                if (closing[i]->flush != NULL)
+                        closing[i]->flush(closing[i]);
+                if (closing[i]->close != NULL)
+                        closing[i]->close(closing[i]);
         }
 }
 
@@ -0,0 +1,285 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * The file sink appends by copying lines into a shared mapping of the file
+ * rather than calling write for each line. The mapped window always starts
+ * on a WINDOW_SIZE boundary and the file is extended to the end of the
+ * window before it is mapped, so the kernel writes pages back in the
+ * background and a crash loses nothing that reached the mapping. When the
+ * file is closed it is truncated back to the bytes actually written. After
+ * a crash the file can end in zeros, and those are trimmed when it is
+ * reopened. Windows has no mmap, so it falls back to buffered stdio.
+ */
+
+#include <rune/core/logging.h>
+#include <rune/core/alloc.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define WINDOW_SIZE     (1 << 20)
+#define MAX_PATH_LEN    4096
+
+struct file_sink {
+        log_sink_t sink;
+#ifdef _WIN32
+        FILE *file;
+#else
+        int fd;
+        char *window;
+        size_t window_off;
+#endif
+        size_t size;
+        size_t max_size;
+        int max_age;
+        int max_files;
+        time_t opened;
+        time_t stamp_sec;
+        char stamp[32];
+        char path[];
+};
+
+#ifdef _WIN32
+
+static int _open_file(struct file_sink *fs) {
+        fs->file = fopen(fs->path, "ab");
+        if (fs->file == NULL)
+                return -1;
+        fseek(fs->file, 0, SEEK_END);
+        fs->size = ftell(fs->file);
+        return 0;
+}
+
+static void _close_file(struct file_sink *fs) {
+        if (fs->file != NULL)
+                fclose(fs->file);
+        fs->file = NULL;
+}
+
+static void _append(struct file_sink *fs, const char *data, size_t len) {
+        if (fs->file == NULL)
+                return;
+        fwrite(data, 1, len, fs->file);
+        fs->size += len;
+}
+
+static void _flush_file(struct file_sink *fs) {
+        if (fs->file != NULL)
+                fflush(fs->file);
+}
+
+#else
+
+static int _map_window(struct file_sink *fs) {
+        if (fs->window != NULL)
+                munmap(fs->window, WINDOW_SIZE);
+        fs->window = NULL;
+        fs->window_off = fs->size & ~((size_t)WINDOW_SIZE - 1);
+        if (ftruncate(fs->fd, fs->window_off + WINDOW_SIZE) != 0)
+                return -1;
+
+        void *window = mmap(NULL, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fs->fd, fs->window_off);
+        if (window == MAP_FAILED)
+                return -1;
+        fs->window = window;
+        return 0;
+}
+
+static size_t _trim_zeros(int fd, size_t size) {
+        char buf[4096];
+        while (size > 0) {
+                size_t chunk = size < sizeof(buf) ? size : sizeof(buf);
+                if (pread(fd, buf, chunk, size - chunk) != (ssize_t)chunk)
+                        break;
+                size_t i = chunk;
+                while (i > 0 && buf[i - 1] == '\0')
+                        i--;
+                if (i > 0)
+                        return size - chunk + i;
+                size -= chunk;
+        }
+        return size;
+}
+
+static int _open_file(struct file_sink *fs) {
+        struct stat st;
+        fs->fd = open(fs->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fs->fd < 0)
+                return -1;
+        if (fstat(fs->fd, &st) != 0) {
+                close(fs->fd);
+                fs->fd = -1;
+                return -1;
+        }
+
+        fs->window = NULL;
+        fs->size = _trim_zeros(fs->fd, st.st_size);
+        if (_map_window(fs) != 0) {
+                close(fs->fd);
+                fs->fd = -1;
+                return -1;
+        }
+        return 0;
+}
+
+static void _close_file(struct file_sink *fs) {
+        if (fs->fd < 0)
+                return;
+        if (fs->window != NULL)
+                munmap(fs->window, WINDOW_SIZE);
+        fs->window = NULL;
+        if (ftruncate(fs->fd, fs->size) != 0)
+                fprintf(stderr, "Cannot truncate log file %s\n", fs->path);
+        close(fs->fd);
+        fs->fd = -1;
+}
+
+static void _append(struct file_sink *fs, const char *data, size_t len) {
+        size_t room, n;
+        while (len > 0 && fs->window != NULL) {
+                if (fs->size == fs->window_off + WINDOW_SIZE && _map_window(fs) != 0) {
+                        fprintf(stderr, "Cannot extend log file %s, further lines are lost\n", fs->path);
+                        return;
+                }
+
+                room = fs->window_off + WINDOW_SIZE - fs->size;
+                n = len < room ? len : room;
+                memcpy(fs->window + (fs->size - fs->window_off), data, n);
+                fs->size += n;
+                data += n;
+                len -= n;
+        }
+}
+
+static void _flush_file(struct file_sink *fs) {
+        if (fs->window != NULL)
+                msync(fs->window, WINDOW_SIZE, MS_ASYNC);
+}
+
+#endif
+
+static int _first_free_index(struct file_sink *fs) {
+        char name[MAX_PATH_LEN];
+        FILE *file;
+        int i;
+        for (i = 1; i < INT_MAX; i++) {
+                snprintf(name, sizeof(name), "%s.%d", fs->path, i);
+                file = fopen(name, "rb");
+                if (file == NULL)
+                        break;
+                fclose(file);
+        }
+        return i;
+}
+
+static void _rotate(struct file_sink *fs) {
+        char from[MAX_PATH_LEN];
+        char to[MAX_PATH_LEN];
+        _close_file(fs);
+        int keep = fs->max_files > 0 ? fs->max_files : _first_free_index(fs);
+        for (int i = keep - 1; i > 0; i--) {
+                snprintf(from, sizeof(from), "%s.%d", fs->path, i);
+                snprintf(to, sizeof(to), "%s.%d", fs->path, i + 1);
+                remove(to);
+                rename(from, to);
+        }
+        snprintf(to, sizeof(to), "%s.1", fs->path);
+        remove(to);
+        rename(fs->path, to);
+
+        if (_open_file(fs) != 0)
+                fprintf(stderr, "Cannot reopen log file %s after rotating it\n", fs->path);
+        fs->opened = time(NULL);
+}
+
+static void _write_file(log_sink_t *sink, int level, const char *line, size_t len) {
+        struct file_sink *fs = sink->data;
+        struct timespec now;
+        timespec_get(&now, TIME_UTC);
+
+        if (now.tv_sec != fs->stamp_sec) {
+                struct tm tm;
+#ifdef _WIN32
+                localtime_s(&tm, &now.tv_sec);
+#else
+                localtime_r(&now.tv_sec, &tm);
+#endif
+                strftime(fs->stamp, sizeof(fs->stamp), "%Y-%m-%d %H:%M:%S", &tm);
+                fs->stamp_sec = now.tv_sec;
+        }
+
+        char prefix[48];
+        int n = snprintf(prefix, sizeof(prefix), "%s.%03ld ", fs->stamp, now.tv_nsec / 1000000);
+        if ((fs->max_size > 0 && fs->size > 0 && fs->size + n + len > fs->max_size)
+                        || (fs->max_age > 0 && now.tv_sec - fs->opened >= fs->max_age))
+                _rotate(fs);
+        _append(fs, prefix, n);
+        _append(fs, line, len);
+}
+
+static void _flush_sink(log_sink_t *sink) {
+        _flush_file(sink->data);
+}
+
+static void _close_sink(log_sink_t *sink) {
+        struct file_sink *fs = sink->data;
+        _close_file(fs);
+        rune_free(fs);
+}
+
+log_sink_t* rune_log_file_sink(const char *path, size_t max_size, int max_age, int max_files) {
+        size_t path_len = strlen(path);
+        if (path_len + 16 > MAX_PATH_LEN) {
+                log_output(LOG_ERROR, "Log file path is too long: %s", path);
+                return NULL;
+        }
+
+        struct file_sink *fs = rune_calloc_tagged(1, sizeof(struct file_sink) + path_len + 1, MEM_TAG_LOG);
+        if (fs == NULL) {
+                log_output(LOG_ERROR, "Cannot allocate log sink for %s", path);
+                return NULL;
+        }
+        memcpy(fs->path, path, path_len + 1);
+        fs->max_size = max_size;
+        fs->max_age = max_age;
+        fs->max_files = max_files;
+        fs->opened = time(NULL);
+        if (_open_file(fs) != 0) {
+                log_output(LOG_ERROR, "Cannot open log file %s", path);
+                rune_free(fs);
+                return NULL;
+        }
+
+        fs->sink.write = _write_file;
+        fs->sink.flush = _flush_sink;
+        fs->sink.close = _close_sink;
+        fs->sink.data = fs;
+        return &fs->sink;
+}
@@ -27,7 +27,10 @@
 #include <dirent.h>
 #include <dlfcn.h>
 
+#define MOD_POOL_SIZE   16
+
 list_head_t *mods = NULL;
+static mem_pool_t *mod_pool = NULL;
 
 void _load_mod(const char *filename) {
         char mod_path[4096];
@@ -71,12 +74,18 @@ void rune_close_mods(void) {
                 mod = (struct mod*)((void*)temp - offsetof(struct mod, list));
                 (*mod->exit_func)();
                 temp = temp->next;
-                rune_free(mod);
+                rune_pool_free(mod_pool, mod);
         }
+        mods = NULL;
+        rune_pool_destroy(mod_pool);
+        mod_pool = NULL;
 }
 
 void rune_register_mod(const char *name, mod_func init_func, mod_func exit_func, mod_func update_func) {
-        struct mod *new = rune_alloc(sizeof(struct mod));
+        if (mod_pool == NULL)
+                mod_pool = rune_pool_create_tagged(sizeof(struct mod), MOD_POOL_SIZE, MEM_TAG_MOD);
+
+        struct mod *new = rune_pool_alloc(mod_pool);
         new->name = name;
         new->init_func = init_func;
         new->exit_func = exit_func;
@@ -0,0 +1,413 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/core/parallel.h>
+#include <rune/core/thread.h>
+#include <rune/core/alloc.h>
+#include "futex.h"
+#include <string.h>
+
+#define MAX_JOBS                64
+#define MAX_CHUNKS              64
+#define MAX_REDUCE_CHUNKS       256
+#define MIN_CHUNK_ITEMS         8192
+#define TARGET_CHUNK_NS         50000
+#define COST_SHIFT              8
+#define COST_TABLE_SIZE         64
+#define RADIX_BITS              8
+#define RADIX_SIZE              (1 << RADIX_BITS)
+
+/*
+ * Every helper splits its range into chunks and queues one job per worker.
+ * The jobs claim chunk indices from a shared counter until none are left,
+ * so a slow chunk never holds up the others. The calling thread runs jobs
+ * from inside rune_job_wait like any other worker.
+ *
+ * Automatic grain sizing keys a small table by the loop body's address. It
+ * holds a smoothed per-item cost in 1/256 ns units, measured on earlier
+ * calls, and aims for chunks of about TARGET_CHUNK_NS. A body that has
+ * never been measured starts with eight chunks per worker. Updates to the
+ * table race benignly: a lost sample only slows convergence.
+ */
+struct task {
+        size_t begin;
+        size_t end;
+        size_t grain;
+        size_t num_chunks;
+        atomic_size_t next;
+        _Atomic int64_t ns;
+        int measure;
+        void (*chunk)(struct task *task, size_t index, size_t begin, size_t end);
+        void *fn;
+        void *arg;
+        void *ctx;
+};
+
+struct cost_entry {
+        _Atomic(uintptr_t) key;
+        _Atomic int64_t cost;
+};
+
+struct reduce_arg {
+        const void *identity;
+        uint8_t *partials;
+        size_t result_size;
+};
+
+struct sort_arg {
+        uint64_t *src_keys;
+        uint64_t *dst_keys;
+        uint32_t *src_vals;
+        uint32_t *dst_vals;
+        size_t (*hist)[RADIX_SIZE];
+        int shift;
+};
+
+static struct cost_entry costs[COST_TABLE_SIZE];
+
+static struct cost_entry* _find_cost(uintptr_t key, int create) {
+        size_t start = (size_t)((key >> 4) * 0x9E3779B97F4A7C15ULL >> 58);
+        struct cost_entry *entry;
+        uintptr_t expected;
+        for (size_t i = 0; i < COST_TABLE_SIZE; i++) {
+                entry = &costs[(start + i) % COST_TABLE_SIZE];
+                expected = atomic_load_explicit(&entry->key, memory_order_acquire);
+                if (expected == key)
+                        return entry;
+                if (expected != 0)
+                        continue;
+                if (create == 0)
+                        return NULL;
+                if (atomic_compare_exchange_strong(&entry->key, &expected, key) || expected == key)
+                        return entry;
+        }
+        return NULL;
+}
+
+static size_t _num_workers(void) {
+        int workers = rune_job_num_workers();
+        return workers > 0 ? (size_t)workers : 1;
+}
+
+static size_t _auto_grain(uintptr_t key, size_t count) {
+        struct cost_entry *entry = _find_cost(key, 0);
+        int64_t cost = entry != NULL ? atomic_load_explicit(&entry->cost, memory_order_relaxed) : 0;
+        size_t grain;
+        if (cost <= 0)
+                grain = count / (_num_workers() * 8);
+        else
+                grain = ((int64_t)TARGET_CHUNK_NS << COST_SHIFT) / cost;
+        return grain > 0 ? grain : 1;
+}
+
+static void _record_cost(uintptr_t key, size_t count, int64_t ns) {
+        struct cost_entry *entry = _find_cost(key, 1);
+        if (entry == NULL || count == 0)
+                return;
+
+        int64_t sample = (ns << COST_SHIFT) / (int64_t)count;
+        if (sample <= 0)
+                sample = 1;
+        int64_t cost = atomic_load_explicit(&entry->cost, memory_order_relaxed);
+        if (cost > 0)
+                sample = cost + (sample - cost) / 4;
+        atomic_store_explicit(&entry->cost, sample, memory_order_relaxed);
+}
+
+static size_t _fixed_chunks(size_t count) {
+        size_t chunks = count / MIN_CHUNK_ITEMS;
+        size_t max = _num_workers() * 4;
+        if (max > MAX_CHUNKS)
+                max = MAX_CHUNKS;
+        if (chunks > max)
+                chunks = max;
+        return chunks > 0 ? chunks : 1;
+}
+
+static void _task_init(struct task *task, size_t begin, size_t end, size_t grain) {
+        task->begin = begin;
+        task->end = end;
+        task->grain = grain > 0 ? grain : 1;
+        task->num_chunks = end > begin ? (end - begin + task->grain - 1) / task->grain : 0;
+        atomic_init(&task->next, 0);
+        atomic_init(&task->ns, 0);
+        task->measure = 0;
+}
+
+static void _task_worker(void *data) {
+        struct task *task = data;
+        size_t index, begin, end;
+        int64_t start;
+        for (;;) {
+                index = atomic_fetch_add_explicit(&task->next, 1, memory_order_relaxed);
+                if (index >= task->num_chunks)
+                        break;
+
+                begin = task->begin + index * task->grain;
+                end = task->end - begin > task->grain ? begin + task->grain : task->end;
+                if (task->measure == 0) {
+                        task->chunk(task, index, begin, end);
+                        continue;
+                }
+                start = futex_clock_ns();
+                task->chunk(task, index, begin, end);
+                atomic_fetch_add_explicit(&task->ns, futex_clock_ns() - start, memory_order_relaxed);
+        }
+}
+
+static void _task_run(struct task *task) {
+        size_t jobs = _num_workers();
+        if (jobs > task->num_chunks)
+                jobs = task->num_chunks;
+        if (jobs > MAX_JOBS)
+                jobs = MAX_JOBS;
+        if (jobs <= 1) {
+                _task_worker(task);
+                return;
+        }
+
+        job_decl_t decls[MAX_JOBS];
+        for (size_t i = 0; i < jobs; i++) {
+                decls[i].fn = _task_worker;
+                decls[i].data = task;
+        }
+        job_counter_t counter = { 0 };
+        rune_job_run(decls, (int)jobs, &counter);
+        rune_job_wait(&counter);
+}
+
+static void _for_chunk(struct task *task, size_t index, size_t begin, size_t end) {
+        ((parallel_for_fn_t)task->fn)(begin, end, task->ctx);
+}
+
+void rune_parallel_for(size_t begin, size_t end, size_t grain, parallel_for_fn_t fn, void *ctx) {
+        if (end <= begin)
+                return;
+
+        int automatic = grain == 0;
+        if (automatic)
+                grain = _auto_grain((uintptr_t)fn, end - begin);
+
+        struct task task;
+        _task_init(&task, begin, end, grain);
+        task.measure = automatic;
+        task.chunk = _for_chunk;
+        task.fn = (void*)fn;
+        task.ctx = ctx;
+        _task_run(&task);
+
+        if (automatic)
+                _record_cost((uintptr_t)fn, end - begin, atomic_load(&task.ns));
+}
+
+static void _reduce_chunk(struct task *task, size_t index, size_t begin, size_t end) {
+        struct reduce_arg *arg = task->arg;
+        uint8_t *partial = arg->partials + index * arg->result_size;
+        memcpy(partial, arg->identity, arg->result_size);
+        ((parallel_reduce_fn_t)task->fn)(begin, end, partial, task->ctx);
+}
+
+int rune_parallel_reduce(size_t begin, size_t end, size_t grain, void *result, size_t result_size, parallel_reduce_fn_t fn, parallel_combine_fn_t combine, void *ctx) {
+        if (end <= begin)
+                return 0;
+
+        size_t count = end - begin;
+        int automatic = grain == 0;
+        if (automatic)
+                grain = _auto_grain((uintptr_t)fn, count);
+        if ((count + grain - 1) / grain > MAX_REDUCE_CHUNKS)
+                grain = (count + MAX_REDUCE_CHUNKS - 1) / MAX_REDUCE_CHUNKS;
+
+        struct task task;
+        _task_init(&task, begin, end, grain);
+        struct reduce_arg arg;
+        arg.identity = result;
+        arg.result_size = result_size;
+        arg.partials = rune_alloc(task.num_chunks * result_size);
+        if (arg.partials == NULL)
+                return -1;
+
+        task.measure = automatic;
+        task.chunk = _reduce_chunk;
+        task.fn = (void*)fn;
+        task.arg = &arg;
+        task.ctx = ctx;
+        _task_run(&task);
+
+        for (size_t i = 0; i < task.num_chunks; i++)
+                combine(result, arg.partials + i * result_size, ctx);
+        rune_free(arg.partials);
+
+        if (automatic)
+                _record_cost((uintptr_t)fn, count, atomic_load(&task.ns));
+        return 0;
+}
+
+static void _histogram_chunk(struct task *task, size_t index, size_t begin, size_t end) {
+        struct sort_arg *arg = task->arg;
+        size_t *hist = arg->hist[index];
+        memset(hist, 0, sizeof(arg->hist[index]));
+        for (size_t i = begin; i < end; i++)
+                hist[(arg->src_keys[i] >> arg->shift) & (RADIX_SIZE - 1)]++;
+}
+
+static void _scatter_chunk(struct task *task, size_t index, size_t begin, size_t end) {
+        struct sort_arg *arg = task->arg;
+        size_t *offsets = arg->hist[index];
+        size_t pos;
+        for (size_t i = begin; i < end; i++) {
+                pos = offsets[(arg->src_keys[i] >> arg->shift) & (RADIX_SIZE - 1)]++;
+                arg->dst_keys[pos] = arg->src_keys[i];
+                if (arg->src_vals != NULL)
+                        arg->dst_vals[pos] = arg->src_vals[i];
+        }
+}
+
+static int _prepare_offsets(struct sort_arg *arg, size_t num_chunks, size_t count) {
+        size_t running = 0;
+        size_t total, tmp;
+        for (int d = 0; d < RADIX_SIZE; d++) {
+                total = 0;
+                for (size_t c = 0; c < num_chunks; c++)
+                        total += arg->hist[c][d];
+                if (total == count)
+                        return -1;
+
+                for (size_t c = 0; c < num_chunks; c++) {
+                        tmp = arg->hist[c][d];
+                        arg->hist[c][d] = running;
+                        running += tmp;
+                }
+        }
+        return 0;
+}
+
+int rune_parallel_radix_sort(uint64_t *keys, uint32_t *values, size_t count, int key_bits) {
+        if (count < 2 || key_bits <= 0)
+                return 0;
+        if (key_bits > 64)
+                key_bits = 64;
+
+        size_t chunks = _fixed_chunks(count);
+        struct sort_arg arg;
+        arg.src_keys = keys;
+        arg.src_vals = values;
+        arg.dst_keys = rune_alloc(count * sizeof(uint64_t));
+        arg.dst_vals = values != NULL ? rune_alloc(count * sizeof(uint32_t)) : NULL;
+        arg.hist = rune_alloc(chunks * sizeof(*arg.hist));
+        if (arg.dst_keys == NULL || arg.hist == NULL || (values != NULL && arg.dst_vals == NULL)) {
+                rune_free(arg.dst_keys);
+                rune_free(arg.dst_vals);
+                rune_free(arg.hist);
+                return -1;
+        }
+        uint64_t *scratch_keys = arg.dst_keys;
+        uint32_t *scratch_vals = arg.dst_vals;
+
+        struct task task;
+        uint64_t *tmp_keys;
+        uint32_t *tmp_vals;
+        for (arg.shift = 0; arg.shift < key_bits; arg.shift += RADIX_BITS) {
+                _task_init(&task, 0, count, (count + chunks - 1) / chunks);
+                task.chunk = _histogram_chunk;
+                task.arg = &arg;
+                _task_run(&task);
+                if (_prepare_offsets(&arg, task.num_chunks, count) != 0)
+                        continue;
+
+                _task_init(&task, 0, count, (count + chunks - 1) / chunks);
+                task.chunk = _scatter_chunk;
+                task.arg = &arg;
+                _task_run(&task);
+
+                tmp_keys = arg.src_keys;
+                arg.src_keys = arg.dst_keys;
+                arg.dst_keys = tmp_keys;
+                tmp_vals = arg.src_vals;
+                arg.src_vals = arg.dst_vals;
+                arg.dst_vals = tmp_vals;
+        }
+
+        if (arg.src_keys != keys) {
+                memcpy(keys, arg.src_keys, count * sizeof(uint64_t));
+                if (values != NULL)
+                        memcpy(values, arg.src_vals, count * sizeof(uint32_t));
+        }
+        rune_free(scratch_keys);
+        rune_free(scratch_vals);
+        rune_free(arg.hist);
+        return 0;
+}
+
+struct scan_arg {
+        const uint64_t *in;
+        uint64_t *out;
+        uint64_t sums[MAX_CHUNKS];
+};
+
+static void _sum_chunk(struct task *task, size_t index, size_t begin, size_t end) {
+        struct scan_arg *arg = task->arg;
+        uint64_t sum = 0;
+        for (size_t i = begin; i < end; i++)
+                sum += arg->in[i];
+        arg->sums[index] = sum;
+}
+
+static void _scan_chunk(struct task *task, size_t index, size_t begin, size_t end) {
+        struct scan_arg *arg = task->arg;
+        uint64_t running = arg->sums[index];
+        uint64_t value;
+        for (size_t i = begin; i < end; i++) {
+                value = arg->in[i];
+                arg->out[i] = running;
+                running += value;
+        }
+}
+
+uint64_t rune_parallel_prefix_sum(const uint64_t *in, uint64_t *out, size_t count) {
+        if (count == 0)
+                return 0;
+
+        size_t chunks = _fixed_chunks(count);
+        struct scan_arg arg;
+        arg.in = in;
+        arg.out = out;
+
+        struct task task;
+        _task_init(&task, 0, count, (count + chunks - 1) / chunks);
+        task.chunk = _sum_chunk;
+        task.arg = &arg;
+        _task_run(&task);
+
+        uint64_t total = 0;
+        uint64_t tmp;
+        for (size_t i = 0; i < task.num_chunks; i++) {
+                tmp = arg.sums[i];
+                arg.sums[i] = total;
+                total += tmp;
+        }
+
+        _task_init(&task, 0, count, (count + chunks - 1) / chunks);
+        task.chunk = _scan_chunk;
+        task.arg = &arg;
+        _task_run(&task);
+        return total;
+}
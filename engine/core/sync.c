@@ -0,0 +1,418 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/core/thread.h>
+#include <rune/core/logging.h>
+#include <rune/core/alloc.h>
+#include "futex.h"
+#include <limits.h>
+
+#define SPIN_COUNT      64
+#define RW_WRITER       -1
+
+#define EVENT_UNSET     0
+#define EVENT_SET       1
+#define EVENT_WAITING   2
+
+/*
+ * Every primitive here is built on futex words. The uncontended path is a
+ * single atomic operation, and the side that makes progress only enters the
+ * kernel when a counter says somebody is actually asleep. Waiters publish
+ * themselves before rechecking the futex word, and wakers change the word
+ * before checking for waiters, so with sequentially consistent ordering at
+ * least one side always sees the other.
+ *
+ * A condition variable is a sequence number that signal and broadcast bump.
+ * A waiter samples it while still holding the mutex, so a signal sent after
+ * the mutex is released changes the word and the futex wait returns at once.
+ *
+ * A reader-writer lock keeps the reader count in one word, or RW_WRITER
+ * while a writer holds it. Waiting writers are counted separately and block
+ * new readers so a steady stream of readers cannot starve a writer. Since
+ * the state word can return to a value a sleeper already saw, sleepers wait
+ * on a separate sequence word that is only bumped when someone is asleep.
+ *
+ * The barrier sleeps on a generation word that the last thread to arrive
+ * bumps, after resetting the arrival count for the next cycle.
+ */
+struct rune_cond {
+        atomic_int seq;
+        atomic_int waiters;
+};
+
+struct rune_rwlock {
+        atomic_int state;
+        atomic_int writers_waiting;
+        atomic_int sleepers;
+        atomic_int seq;
+};
+
+struct rune_sem {
+        atomic_int count;
+        atomic_int waiters;
+};
+
+struct rune_event {
+        atomic_int state;
+};
+
+struct rune_barrier {
+        int count;
+        atomic_int remaining;
+        atomic_int generation;
+};
+
+static int64_t _deadline(int64_t timeout_ns) {
+        if (timeout_ns < 0)
+                return -1;
+        return futex_clock_ns() + timeout_ns;
+}
+
+static int _wait_until(atomic_int *addr, int expected, int64_t deadline) {
+        if (deadline < 0)
+                return futex_wait(addr, expected, -1);
+
+        int64_t left = deadline - futex_clock_ns();
+        if (left <= 0)
+                return -1;
+        return futex_wait(addr, expected, left);
+}
+
+rune_cond_t* rune_cond_new(void) {
+        rune_cond_t *ret = rune_alloc_tagged(sizeof(rune_cond_t), MEM_TAG_THREAD);
+        if (ret == NULL)
+                return NULL;
+
+        atomic_init(&ret->seq, 0);
+        atomic_init(&ret->waiters, 0);
+        return ret;
+}
+
+void rune_cond_free(rune_cond_t *cond) {
+        if (cond == NULL)
+                return;
+
+        if (atomic_load(&cond->waiters) != 0)
+                log_output(LOG_WARN, "Destroying condition variable %p with waiters", cond);
+        rune_free(cond);
+}
+
+static int _cond_wait(rune_cond_t *cond, rune_mutex_t *mutex, int64_t timeout_ns) {
+        atomic_fetch_add(&cond->waiters, 1);
+        int seq = atomic_load(&cond->seq);
+        rune_mutex_release(mutex);
+        int ret = futex_wait(&cond->seq, seq, timeout_ns);
+        atomic_fetch_sub(&cond->waiters, 1);
+        rune_mutex_acquire(mutex);
+        return ret;
+}
+
+void rune_cond_wait(rune_cond_t *cond, rune_mutex_t *mutex) {
+        _cond_wait(cond, mutex, -1);
+}
+
+int rune_cond_wait_timeout(rune_cond_t *cond, rune_mutex_t *mutex, int64_t timeout_ns) {
+        if (timeout_ns < 0)
+                timeout_ns = 0;
+        return _cond_wait(cond, mutex, timeout_ns);
+}
+
+void rune_cond_signal(rune_cond_t *cond) {
+        atomic_fetch_add(&cond->seq, 1);
+        if (atomic_load(&cond->waiters) > 0)
+                futex_wake(&cond->seq, 1);
+}
+
+void rune_cond_broadcast(rune_cond_t *cond) {
+        atomic_fetch_add(&cond->seq, 1);
+        if (atomic_load(&cond->waiters) > 0)
+                futex_wake(&cond->seq, INT_MAX);
+}
+
+rune_rwlock_t* rune_rwlock_new(void) {
+        rune_rwlock_t *ret = rune_alloc_tagged(sizeof(rune_rwlock_t), MEM_TAG_THREAD);
+        if (ret == NULL)
+                return NULL;
+
+        atomic_init(&ret->state, 0);
+        atomic_init(&ret->writers_waiting, 0);
+        atomic_init(&ret->sleepers, 0);
+        atomic_init(&ret->seq, 0);
+        return ret;
+}
+
+void rune_rwlock_free(rune_rwlock_t *lock) {
+        if (lock == NULL)
+                return;
+
+        if (atomic_load(&lock->state) != 0)
+                log_output(LOG_WARN, "Destroying rwlock %p while it is held", lock);
+        rune_free(lock);
+}
+
+static void _rwlock_acquire(rune_rwlock_t *lock, int (*try_acquire)(rune_rwlock_t*)) {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+                if (try_acquire(lock) == 0)
+                        return;
+                cpu_relax();
+        }
+
+        int seq;
+        for (;;) {
+                atomic_fetch_add(&lock->sleepers, 1);
+                seq = atomic_load(&lock->seq);
+                if (try_acquire(lock) == 0) {
+                        atomic_fetch_sub(&lock->sleepers, 1);
+                        return;
+                }
+                futex_wait(&lock->seq, seq, -1);
+                atomic_fetch_sub(&lock->sleepers, 1);
+        }
+}
+
+static void _rwlock_wake(rune_rwlock_t *lock) {
+        if (atomic_load(&lock->sleepers) > 0) {
+                atomic_fetch_add(&lock->seq, 1);
+                futex_wake(&lock->seq, INT_MAX);
+        }
+}
+
+int rune_rwlock_try_read_acquire(rune_rwlock_t *lock) {
+        int state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        while (state != RW_WRITER && atomic_load(&lock->writers_waiting) == 0) {
+                if (atomic_compare_exchange_weak_explicit(&lock->state, &state, state + 1,
+                                        memory_order_acquire, memory_order_relaxed))
+                        return 0;
+        }
+        return -1;
+}
+
+void rune_rwlock_read_acquire(rune_rwlock_t *lock) {
+        if (rune_rwlock_try_read_acquire(lock) == 0)
+                return;
+        _rwlock_acquire(lock, rune_rwlock_try_read_acquire);
+}
+
+void rune_rwlock_read_release(rune_rwlock_t *lock) {
+        if (atomic_fetch_sub(&lock->state, 1) == 1)
+                _rwlock_wake(lock);
+}
+
+int rune_rwlock_try_write_acquire(rune_rwlock_t *lock) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong_explicit(&lock->state, &expected, RW_WRITER,
+                                memory_order_acquire, memory_order_relaxed))
+                return 0;
+        return -1;
+}
+
+void rune_rwlock_write_acquire(rune_rwlock_t *lock) {
+        if (rune_rwlock_try_write_acquire(lock) == 0)
+                return;
+
+        atomic_fetch_add(&lock->writers_waiting, 1);
+        _rwlock_acquire(lock, rune_rwlock_try_write_acquire);
+        if (atomic_fetch_sub(&lock->writers_waiting, 1) == 1)
+                _rwlock_wake(lock);
+}
+
+void rune_rwlock_write_release(rune_rwlock_t *lock) {
+        atomic_store(&lock->state, 0);
+        _rwlock_wake(lock);
+}
+
+rune_sem_t* rune_sem_new(int initial) {
+        if (initial < 0)
+                return NULL;
+
+        rune_sem_t *ret = rune_alloc_tagged(sizeof(rune_sem_t), MEM_TAG_THREAD);
+        if (ret == NULL)
+                return NULL;
+
+        atomic_init(&ret->count, initial);
+        atomic_init(&ret->waiters, 0);
+        return ret;
+}
+
+void rune_sem_free(rune_sem_t *sem) {
+        if (sem == NULL)
+                return;
+
+        if (atomic_load(&sem->waiters) != 0)
+                log_output(LOG_WARN, "Destroying semaphore %p with waiters", sem);
+        rune_free(sem);
+}
+
+int rune_sem_try_wait(rune_sem_t *sem) {
+        int count = atomic_load_explicit(&sem->count, memory_order_relaxed);
+        while (count > 0) {
+                if (atomic_compare_exchange_weak_explicit(&sem->count, &count, count - 1,
+                                        memory_order_acquire, memory_order_relaxed))
+                        return 0;
+        }
+        return -1;
+}
+
+static int _sem_wait(rune_sem_t *sem, int64_t deadline) {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+                if (rune_sem_try_wait(sem) == 0)
+                        return 0;
+                cpu_relax();
+        }
+
+        int ret = 0;
+        atomic_fetch_add(&sem->waiters, 1);
+        while (rune_sem_try_wait(sem) != 0) {
+                if (_wait_until(&sem->count, 0, deadline) != 0) {
+                        ret = rune_sem_try_wait(sem);
+                        break;
+                }
+        }
+        atomic_fetch_sub(&sem->waiters, 1);
+        return ret;
+}
+
+void rune_sem_wait(rune_sem_t *sem) {
+        _sem_wait(sem, -1);
+}
+
+int rune_sem_wait_timeout(rune_sem_t *sem, int64_t timeout_ns) {
+        if (rune_sem_try_wait(sem) == 0)
+                return 0;
+        if (timeout_ns <= 0)
+                return -1;
+        return _sem_wait(sem, _deadline(timeout_ns));
+}
+
+void rune_sem_post(rune_sem_t *sem, int count) {
+        if (count <= 0)
+                return;
+
+        atomic_fetch_add(&sem->count, count);
+        int waiters = atomic_load(&sem->waiters);
+        if (waiters > 0)
+                futex_wake(&sem->count, count < waiters ? count : waiters);
+}
+
+rune_event_t* rune_event_new(void) {
+        rune_event_t *ret = rune_alloc_tagged(sizeof(rune_event_t), MEM_TAG_THREAD);
+        if (ret == NULL)
+                return NULL;
+
+        atomic_init(&ret->state, EVENT_UNSET);
+        return ret;
+}
+
+void rune_event_free(rune_event_t *event) {
+        if (event == NULL)
+                return;
+
+        if (atomic_load(&event->state) == EVENT_WAITING)
+                log_output(LOG_WARN, "Destroying event %p with waiters", event);
+        rune_free(event);
+}
+
+void rune_event_set(rune_event_t *event) {
+        if (atomic_exchange_explicit(&event->state, EVENT_SET, memory_order_release) == EVENT_WAITING)
+                futex_wake(&event->state, INT_MAX);
+}
+
+void rune_event_reset(rune_event_t *event) {
+        int expected = EVENT_SET;
+        atomic_compare_exchange_strong(&event->state, &expected, EVENT_UNSET);
+}
+
+int rune_event_is_set(rune_event_t *event) {
+        return atomic_load_explicit(&event->state, memory_order_acquire) == EVENT_SET;
+}
+
+static int _event_wait(rune_event_t *event, int64_t deadline) {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+                if (rune_event_is_set(event))
+                        return 0;
+                cpu_relax();
+        }
+
+        int expected;
+        while (!rune_event_is_set(event)) {
+                expected = EVENT_UNSET;
+                atomic_compare_exchange_strong(&event->state, &expected, EVENT_WAITING);
+                if (expected == EVENT_SET)
+                        return 0;
+                if (_wait_until(&event->state, EVENT_WAITING, deadline) != 0)
+                        return rune_event_is_set(event) ? 0 : -1;
+        }
+        return 0;
+}
+
+void rune_event_wait(rune_event_t *event) {
+        _event_wait(event, -1);
+}
+
+int rune_event_wait_timeout(rune_event_t *event, int64_t timeout_ns) {
+        if (rune_event_is_set(event))
+                return 0;
+        if (timeout_ns <= 0)
+                return -1;
+        return _event_wait(event, _deadline(timeout_ns));
+}
+
+rune_barrier_t* rune_barrier_new(int count) {
+        if (count < 1)
+                return NULL;
+
+        rune_barrier_t *ret = rune_alloc_tagged(sizeof(rune_barrier_t), MEM_TAG_THREAD);
+        if (ret == NULL)
+                return NULL;
+
+        ret->count = count;
+        atomic_init(&ret->remaining, count);
+        atomic_init(&ret->generation, 0);
+        return ret;
+}
+
+void rune_barrier_free(rune_barrier_t *barrier) {
+        if (barrier == NULL)
+                return;
+
+        if (atomic_load(&barrier->remaining) != barrier->count)
+                log_output(LOG_WARN, "Destroying barrier %p with waiters", barrier);
+        rune_free(barrier);
+}
+
+int rune_barrier_wait(rune_barrier_t *barrier) {
+        int gen = atomic_load_explicit(&barrier->generation, memory_order_acquire);
+        if (atomic_fetch_sub_explicit(&barrier->remaining, 1, memory_order_acq_rel) == 1) {
+                atomic_store_explicit(&barrier->remaining, barrier->count, memory_order_relaxed);
+                atomic_fetch_add_explicit(&barrier->generation, 1, memory_order_release);
+                futex_wake(&barrier->generation, INT_MAX);
+                return 1;
+        }
+
+        for (int i = 0; i < SPIN_COUNT; i++) {
+                if (atomic_load_explicit(&barrier->generation, memory_order_acquire) != gen)
+                        return 0;
+                cpu_relax();
+        }
+        while (atomic_load_explicit(&barrier->generation, memory_order_acquire) == gen)
+                futex_wait(&barrier->generation, gen, -1);
+        return 0;
+}
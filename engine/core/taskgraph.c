@@ -0,0 +1,331 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/core/taskgraph.h>
+#include <rune/core/thread.h>
+#include <rune/core/logging.h>
+#include <rune/core/alloc.h>
+#include "futex.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_NAME_LEN    32
+#define REPORT_LEN      1024
+#define EWMA_SHIFT      3
+
+/*
+ * Stages and their dependencies are kept as 64-bit masks, one bit per
+ * stage, which keeps building the DAG and walking successors trivial.
+ * Registration order stands in for program order: a stage depends on every
+ * earlier stage it conflicts with, exactly as if the stages ran serially.
+ *
+ * Every run resets a per-stage count of unfinished predecessors and queues
+ * the stages that have none. Each finishing stage decrements its successors
+ * and queues the ones that reach zero itself, so no thread has to
+ * coordinate the graph while it runs. All stage jobs share one counter that
+ * the caller waits on.
+ */
+struct stage {
+        char name[MAX_NAME_LEN];
+        task_stage_fn_t fn;
+        void *data;
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t explicit_preds;
+        uint64_t preds;
+        uint64_t succs;
+        int num_preds;
+        atomic_int remaining;
+        int64_t start;
+        int64_t end;
+        int64_t avg_ns;
+        struct task_graph *graph;
+};
+
+struct task_graph {
+        struct stage stages[TASKGRAPH_MAX_STAGES];
+        int num_stages;
+        char resources[TASKGRAPH_MAX_RESOURCES][MAX_NAME_LEN];
+        int num_resources;
+        int built;
+        int order[TASKGRAPH_MAX_STAGES];
+        job_counter_t counter;
+        int64_t avg_frame_ns;
+        int critical[TASKGRAPH_MAX_STAGES];
+        int critical_len;
+        int64_t critical_ns;
+        int report_interval;
+        int runs;
+};
+
+task_graph_t* rune_taskgraph_new(void) {
+        task_graph_t *ret = rune_calloc_tagged(1, sizeof(task_graph_t), MEM_TAG_THREAD);
+        if (ret == NULL)
+                return NULL;
+
+        atomic_init(&ret->counter.value, 0);
+        return ret;
+}
+
+void rune_taskgraph_free(task_graph_t *graph) {
+        if (graph == NULL)
+                return;
+        rune_free(graph);
+}
+
+uint64_t rune_taskgraph_resource(task_graph_t *graph, const char *name) {
+        for (int i = 0; i < graph->num_resources; i++) {
+                if (strncmp(graph->resources[i], name, MAX_NAME_LEN - 1) == 0)
+                        return (uint64_t)1 << i;
+        }
+
+        if (graph->num_resources == TASKGRAPH_MAX_RESOURCES) {
+                log_output(LOG_ERROR, "Task graph has too many resources, cannot add %s", name);
+                return 0;
+        }
+        int i = graph->num_resources++;
+        snprintf(graph->resources[i], MAX_NAME_LEN, "%s", name);
+        return (uint64_t)1 << i;
+}
+
+int rune_taskgraph_add_stage(task_graph_t *graph, const char *name, task_stage_fn_t fn, void *data, uint64_t reads, uint64_t writes) {
+        if (graph->num_stages == TASKGRAPH_MAX_STAGES) {
+                log_output(LOG_ERROR, "Task graph has too many stages, cannot add %s", name);
+                return -1;
+        }
+
+        int i = graph->num_stages++;
+        struct stage *stage = &graph->stages[i];
+        memset(stage, 0, sizeof(*stage));
+        snprintf(stage->name, MAX_NAME_LEN, "%s", name);
+        stage->fn = fn;
+        stage->data = data;
+        stage->reads = reads;
+        stage->writes = writes;
+        stage->graph = graph;
+        atomic_init(&stage->remaining, 0);
+        graph->built = 0;
+        return i;
+}
+
+int rune_taskgraph_add_dependency(task_graph_t *graph, int before, int after) {
+        if (before < 0 || before >= graph->num_stages || after < 0 || after >= graph->num_stages || before == after)
+                return -1;
+
+        graph->stages[after].explicit_preds |= (uint64_t)1 << before;
+        graph->built = 0;
+        return 0;
+}
+
+static int _conflicts(struct stage *a, struct stage *b) {
+        return (a->writes & (b->reads | b->writes)) != 0 || (a->reads & b->writes) != 0;
+}
+
+static int _sort_stages(task_graph_t *graph) {
+        uint64_t done = 0;
+        int count = 0;
+        int progress;
+        while (count < graph->num_stages) {
+                progress = 0;
+                for (int i = 0; i < graph->num_stages; i++) {
+                        if ((done >> i) & 1 || (graph->stages[i].preds & ~done) != 0)
+                                continue;
+                        graph->order[count++] = i;
+                        done |= (uint64_t)1 << i;
+                        progress = 1;
+                }
+                if (progress == 0)
+                        return -1;
+        }
+        return 0;
+}
+
+int rune_taskgraph_build(task_graph_t *graph) {
+        struct stage *stage;
+        for (int i = 0; i < graph->num_stages; i++) {
+                stage = &graph->stages[i];
+                stage->preds = stage->explicit_preds;
+                for (int j = 0; j < i; j++) {
+                        if (_conflicts(&graph->stages[j], stage))
+                                stage->preds |= (uint64_t)1 << j;
+                }
+        }
+
+        if (_sort_stages(graph) != 0) {
+                log_output(LOG_ERROR, "Task graph dependencies form a cycle");
+                return -1;
+        }
+
+        uint64_t ancestors[TASKGRAPH_MAX_STAGES];
+        uint64_t implied, preds;
+        int p;
+        for (int i = 0; i < graph->num_stages; i++) {
+                stage = &graph->stages[graph->order[i]];
+                implied = 0;
+                for (preds = stage->preds; preds != 0; preds &= preds - 1) {
+                        p = __builtin_ctzll(preds);
+                        implied |= ancestors[p];
+                }
+                stage->preds &= ~implied;
+                ancestors[graph->order[i]] = implied | stage->preds;
+                stage->succs = 0;
+        }
+
+        for (int i = 0; i < graph->num_stages; i++) {
+                stage = &graph->stages[i];
+                stage->num_preds = __builtin_popcountll(stage->preds);
+                for (preds = stage->preds; preds != 0; preds &= preds - 1)
+                        graph->stages[__builtin_ctzll(preds)].succs |= (uint64_t)1 << i;
+        }
+
+        graph->built = 1;
+        RLOG_DEBUG("Built task graph with %d stages", graph->num_stages);
+        return 0;
+}
+
+static void _run_stage(void *data) {
+        struct stage *stage = data;
+        task_graph_t *graph = stage->graph;
+        stage->start = futex_clock_ns();
+        stage->fn(stage->data);
+        stage->end = futex_clock_ns();
+
+        job_decl_t job;
+        struct stage *next;
+        for (uint64_t succs = stage->succs; succs != 0; succs &= succs - 1) {
+                next = &graph->stages[__builtin_ctzll(succs)];
+                if (atomic_fetch_sub_explicit(&next->remaining, 1, memory_order_acq_rel) == 1) {
+                        job.fn = _run_stage;
+                        job.data = next;
+                        rune_job_run(&job, 1, &graph->counter);
+                }
+        }
+}
+
+static void _update_critical_path(task_graph_t *graph) {
+        int64_t finish[TASKGRAPH_MAX_STAGES];
+        int prev[TASKGRAPH_MAX_STAGES];
+        int last = -1;
+        int i, p;
+        struct stage *stage;
+        for (int n = 0; n < graph->num_stages; n++) {
+                i = graph->order[n];
+                stage = &graph->stages[i];
+                finish[i] = 0;
+                prev[i] = -1;
+                for (uint64_t preds = stage->preds; preds != 0; preds &= preds - 1) {
+                        p = __builtin_ctzll(preds);
+                        if (finish[p] > finish[i]) {
+                                finish[i] = finish[p];
+                                prev[i] = p;
+                        }
+                }
+                finish[i] += stage->avg_ns;
+                if (last == -1 || finish[i] > finish[last])
+                        last = i;
+        }
+
+        graph->critical_len = 0;
+        graph->critical_ns = last >= 0 ? finish[last] : 0;
+        for (i = last; i != -1; i = prev[i])
+                graph->critical[graph->critical_len++] = i;
+        for (int a = 0, b = graph->critical_len - 1; a < b; a++, b--) {
+                p = graph->critical[a];
+                graph->critical[a] = graph->critical[b];
+                graph->critical[b] = p;
+        }
+}
+
+static void _report(task_graph_t *graph) {
+        char buf[REPORT_LEN];
+        size_t len = 0;
+        struct stage *stage;
+        for (int i = 0; i < graph->critical_len && len < sizeof(buf); i++) {
+                stage = &graph->stages[graph->critical[i]];
+                len += snprintf(buf + len, sizeof(buf) - len, "%s%s (%.3f ms)",
+                                i > 0 ? " -> " : "", stage->name, stage->avg_ns / 1e6);
+        }
+        log_output(LOG_INFO, "Task graph critical path %.3f ms of %.3f ms: %s",
+                        graph->critical_ns / 1e6, graph->avg_frame_ns / 1e6, buf);
+}
+
+int rune_taskgraph_run(task_graph_t *graph) {
+        if (graph->built == 0 && rune_taskgraph_build(graph) != 0)
+                return -1;
+
+        job_decl_t roots[TASKGRAPH_MAX_STAGES];
+        int num_roots = 0;
+        struct stage *stage;
+        for (int i = 0; i < graph->num_stages; i++) {
+                stage = &graph->stages[i];
+                atomic_store_explicit(&stage->remaining, stage->num_preds, memory_order_relaxed);
+                if (stage->num_preds == 0) {
+                        roots[num_roots].fn = _run_stage;
+                        roots[num_roots].data = stage;
+                        num_roots++;
+                }
+        }
+
+        int64_t start = futex_clock_ns();
+        rune_job_run(roots, num_roots, &graph->counter);
+        rune_job_wait(&graph->counter);
+        int64_t frame_ns = futex_clock_ns() - start;
+
+        int64_t duration;
+        for (int i = 0; i < graph->num_stages; i++) {
+                stage = &graph->stages[i];
+                duration = stage->end - stage->start;
+                if (graph->runs == 0)
+                        stage->avg_ns = duration;
+                else
+                        stage->avg_ns += (duration - stage->avg_ns) >> EWMA_SHIFT;
+        }
+        if (graph->runs == 0)
+                graph->avg_frame_ns = frame_ns;
+        else
+                graph->avg_frame_ns += (frame_ns - graph->avg_frame_ns) >> EWMA_SHIFT;
+        graph->runs++;
+
+        _update_critical_path(graph);
+        if (graph->report_interval > 0 && graph->runs % graph->report_interval == 0)
+                _report(graph);
+        return 0;
+}
+
+int rune_taskgraph_critical_path(task_graph_t *graph, int *stages, int max, int64_t *length_ns) {
+        if (length_ns != NULL)
+                *length_ns = graph->critical_ns;
+        if (stages != NULL) {
+                for (int i = 0; i < graph->critical_len && i < max; i++)
+                        stages[i] = graph->critical[i];
+        }
+        return graph->critical_len;
+}
+
+const char* rune_taskgraph_stage_name(task_graph_t *graph, int stage) {
+        if (stage < 0 || stage >= graph->num_stages)
+                return NULL;
+        return graph->stages[stage].name;
+}
+
+void rune_taskgraph_set_report_interval(task_graph_t *graph, int frames) {
+        graph->report_interval = frames > 0 ? frames : 0;
+}
@@ -19,16 +19,84 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+#define _GNU_SOURCE
+
 #include <rune/core/thread.h>
 #include <rune/core/logging.h>
 #include <rune/core/alloc.h>
+#include "futex.h"
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdatomic.h>
 
-static list_head_t *threads = NULL;
-static list_head_t *mutexes = NULL;
-static int next_tid = 0;
+#ifdef __linux__
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define THREAD_POOL_SIZE        32
+#define MUTEX_POOL_SIZE         64
+#define MUTEX_CHUNK_SIZE        64
+#define MAX_MUTEX_CHUNKS        256
+#define MAX_MUTEX_IDS           (MUTEX_CHUNK_SIZE * MAX_MUTEX_CHUNKS)
+#define MAX_SPIN                1000
+#define MAX_TLS_SLOTS           64
+#define MAX_NAME_LEN            15
+#define HIGH_PRIORITY_NICE      -5
+
+#define MUTEX_UNLOCKED          0
+#define MUTEX_LOCKED            1
+#define MUTEX_CONTENDED         2
+
+/*
+ * A mutex is a single futex word: 0 when unlocked, 1 when locked and 2 when
+ * locked with sleeping waiters, so unlocking only enters the kernel if
+ * someone is actually asleep. Before going to sleep a contended locker spins
+ * for up to twice the number of spins that recent acquisitions needed.
+ *
+ * The integer mutex API maps IDs onto handles through a table of fixed-size
+ * chunks that never move once allocated, so lookups need no lock.
+ */
+struct rune_mutex {
+        atomic_int state;
+        atomic_int spin;
+};
+
+typedef _Atomic(rune_mutex_t*) mutex_slot_t;
+
+/*
+ * TLS slots carry a generation that is bumped whenever the slot is freed, so
+ * values a thread stored under a previous owner of the slot read as NULL
+ * instead of leaking into the new one.
+ */
+struct tls_slot {
+        atomic_uint gen;
+        atomic_int used;
+        void (*destructor)(void *value);
+};
+
+struct tls_value {
+        unsigned int gen;
+        void *value;
+};
+
+static list_head_t threads = { NULL, NULL };
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_pool_t *thread_pool = NULL;
+static mem_pool_t *mutex_pool = NULL;
+static atomic_int next_tid = 0;
+static _Thread_local struct thread *self_thread = NULL;
+
+static struct tls_slot tls_slots[MAX_TLS_SLOTS];
+static _Thread_local struct tls_value tls_values[MAX_TLS_SLOTS];
+
+static _Atomic(mutex_slot_t*) mutex_chunks[MAX_MUTEX_CHUNKS];
+static struct rune_mutex registry_lock;
+static int free_mids[MAX_MUTEX_IDS];
+static int num_free_mids = 0;
 static int next_mid = 0;
 
 struct start_args {
@@ -37,107 +105,164 @@ struct start_args {
         void *thread_args;
 };
 
-static struct thread* _find_thread_by_handle(void *handle) {
-        if (threads == NULL)
-                return NULL;
-
-        list_head_t *temp = threads;
-        struct thread *ret;
-        while (temp != NULL) {
+static struct thread* _find_thread_by_id(int ID) {
+        list_head_t *temp;
+        struct thread *ret = NULL;
+        pthread_mutex_lock(&list_lock);
+        for (temp = threads.next; temp != NULL; temp = temp->next) {
                 ret = (struct thread*)((void*)temp - offsetof(struct thread, list));
-                if (pthread_equal(*(pthread_t*)ret->thread_handle, *(pthread_t*)handle) == 1)
-                        return ret;
-                temp = temp->next;
+                if (ret->ID == ID)
+                        break;
+                ret = NULL;
         }
-        return NULL;
+        pthread_mutex_unlock(&list_lock);
+        return ret;
 }
 
-static struct thread* _find_thread_by_id(int ID) {
-        if (threads == NULL)
+static mutex_slot_t* _find_mutex_slot(int ID) {
+        if (ID < 0 || ID >= MAX_MUTEX_IDS)
                 return NULL;
 
-        list_head_t *temp = threads;
-        struct thread *ret;
-        while (temp != NULL) {
-                ret = (struct thread*)((void*)temp - offsetof(struct thread, list));
-                if (ret->ID == ID)
-                        return ret;
-                temp = temp->next;
-        }
-        return NULL;
+        mutex_slot_t *chunk = atomic_load_explicit(&mutex_chunks[ID / MUTEX_CHUNK_SIZE], memory_order_acquire);
+        if (chunk == NULL)
+                return NULL;
+        return &chunk[ID % MUTEX_CHUNK_SIZE];
 }
 
-static struct mutex* _find_mutex_by_id(int ID) {
-        if (mutexes == NULL)
+static rune_mutex_t* _find_mutex_by_id(int ID) {
+        mutex_slot_t *slot = _find_mutex_slot(ID);
+        if (slot == NULL)
                 return NULL;
+        return atomic_load_explicit(slot, memory_order_acquire);
+}
 
-        list_head_t *temp = mutexes;
-        struct mutex *ret;
-        while (temp != NULL) {
-                ret = (struct mutex*)((void*)temp - offsetof(struct mutex, list));
-                if (ret->ID == ID)
-                        return ret;
-                temp = temp->next;
-        }
-        return NULL;
+
+static void _release_thread(struct thread *thread) {
+        pthread_mutex_lock(&list_lock);
+        list_del(&thread->list);
+        pthread_mutex_unlock(&list_lock);
+        rune_free(thread->thread_handle);
+        rune_pool_free(thread_pool, thread);
 }
 
+static void _run_tls_destructors(void) {
+        void (*destructor)(void*);
+        void *value;
+        for (int i = 0; i < MAX_TLS_SLOTS; i++) {
+                value = rune_tls_get(i);
+                if (value == NULL)
+                        continue;
+
+                tls_values[i].value = NULL;
+                destructor = tls_slots[i].destructor;
+                if (destructor != NULL)
+                        destructor(value);
+        }
+}
 
 static void _cleanup_pthread(void *arg) {
         struct thread *thread = (struct thread*)arg;
-        if (&thread->list != threads)
-                list_del(&thread->list);
-        rune_free(thread->thread_handle);
-        rune_free(thread);
+        _run_tls_destructors();
+        self_thread = NULL;
+        if (thread->detached == 1)
+                _release_thread(thread);
+}
+
+static int _os_thread_id(void) {
+#ifdef __linux__
+        return syscall(SYS_gettid);
+#else
+        return 0;
+#endif
 }
 
 static void* _startup_pthread(void *arg) {
-        struct start_args *start_args = (struct start_args*)arg;
+        struct start_args start_args = *(struct start_args*)arg;
+        rune_free(arg);
+        self_thread = start_args.thread;
+        atomic_store(&start_args.thread->os_id, _os_thread_id());
 
-        void* (*thread_fn)(void *data) = start_args->thread_fn;
-        pthread_cleanup_push(_cleanup_pthread, start_args->thread);
-        if (thread_fn != NULL)
-                (*thread_fn)(start_args->thread_args);
+        pthread_cleanup_push(_cleanup_pthread, start_args.thread);
+        if (start_args.thread_fn != NULL)
+                (*start_args.thread_fn)(start_args.thread_args);
         pthread_cleanup_pop(1);
         return NULL;
 }
 
 void rune_init_thread_api(void) {
-        struct thread *start_thread = rune_alloc(sizeof(struct thread));
-        start_thread->ID = next_tid++;
+        thread_pool = rune_pool_create_tagged(sizeof(struct thread), THREAD_POOL_SIZE, MEM_TAG_THREAD);
+        mutex_pool = rune_pool_create_tagged(sizeof(rune_mutex_t), MUTEX_POOL_SIZE, MEM_TAG_THREAD);
+
+        struct thread *start_thread = rune_pool_alloc(thread_pool);
+        start_thread->ID = atomic_fetch_add(&next_tid, 1);
         start_thread->detached = 0;
-        start_thread->thread_handle = rune_alloc(sizeof(pthread_t));
+        start_thread->thread_handle = rune_alloc_tagged(sizeof(pthread_t), MEM_TAG_THREAD);
         *(pthread_t*)start_thread->thread_handle = pthread_self();
-        pthread_cleanup_push(_cleanup_pthread, threads);
-        pthread_cleanup_pop(0);
+        atomic_store(&start_thread->os_id, _os_thread_id());
+        pthread_mutex_lock(&list_lock);
+        list_insert(&start_thread->list, &threads);
+        pthread_mutex_unlock(&list_lock);
+        self_thread = start_thread;
+}
+
+void rune_close_thread_api(void) {
+        list_head_t *temp;
+        struct thread *thread;
+        pthread_mutex_lock(&list_lock);
+        for (temp = threads.next; temp != NULL; temp = temp->next) {
+                thread = (struct thread*)((void*)temp - offsetof(struct thread, list));
+                rune_free(thread->thread_handle);
+        }
+        threads.next = NULL;
+        threads.prev = NULL;
+        pthread_mutex_unlock(&list_lock);
+        self_thread = NULL;
+        atomic_store(&next_tid, 0);
+
+        for (int i = 0; i < MAX_MUTEX_CHUNKS; i++) {
+                rune_free(atomic_load(&mutex_chunks[i]));
+                atomic_store(&mutex_chunks[i], NULL);
+        }
+        num_free_mids = 0;
+        next_mid = 0;
+
+        rune_pool_destroy(mutex_pool);
+        mutex_pool = NULL;
+        rune_pool_destroy(thread_pool);
+        thread_pool = NULL;
 }
 
 int rune_thread_init(void* (*thread_fn)(void *data), void *data, int detached) {
-        struct thread *thread = rune_alloc(sizeof(struct thread));
-        thread->ID = next_tid++;
+        struct thread *thread = rune_pool_alloc(thread_pool);
+        thread->ID = atomic_fetch_add(&next_tid, 1);
         thread->detached = detached;
-        thread->thread_handle = rune_alloc(sizeof(pthread_t));
-        if (threads == NULL)
-                threads = &thread->list;
-        else
-                list_add(&thread->list, threads);
+        thread->thread_handle = rune_alloc_tagged(sizeof(pthread_t), MEM_TAG_THREAD);
+        atomic_store(&thread->os_id, 0);
+        pthread_mutex_lock(&list_lock);
+        list_insert(&thread->list, &threads);
+        pthread_mutex_unlock(&list_lock);
 
-        struct start_args *args = rune_alloc(sizeof(struct start_args));
+        struct start_args *args = rune_alloc_tagged(sizeof(struct start_args), MEM_TAG_THREAD);
         args->thread = thread;
         args->thread_fn = thread_fn;
         args->thread_args = data;
-        int retval = pthread_create(thread->thread_handle, NULL, _startup_pthread, args);
-        rune_free(args);
+        int ID = thread->ID;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (detached == 1)
+                pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int retval = pthread_create(thread->thread_handle, &attr, _startup_pthread, args);
+        pthread_attr_destroy(&attr);
         if (retval != 0) {
+                rune_free(args);
+                _release_thread(thread);
                 log_output(LOG_ERROR, "Thread creation failed: %s", strerror(retval));
                 return -1;
         }
-        log_output(LOG_DEBUG, "Initialized new thread with ID=%d", thread->ID);
-        if (detached == 1) {
-                log_output(LOG_DEBUG, "Thread %d has been detached, join no longer possible");
-                pthread_detach(*(pthread_t*)thread->thread_handle);
-        }
-        return thread->ID;
+        log_output(LOG_DEBUG, "Initialized new thread with ID=%d", ID);
+        if (detached == 1)
+                log_output(LOG_DEBUG, "Thread %d has been detached, join no longer possible", ID);
+        return ID;
 }
 
 int rune_thread_cancel(int ID) {
@@ -161,58 +286,323 @@ int rune_thread_join(int ID, void **retval) {
                 return -1;
         }
         pthread_join(*((pthread_t*)thread->thread_handle), retval);
+        _release_thread(thread);
         return 0;
 }
 
 int rune_thread_self(void) {
-        pthread_t cur = pthread_self();
-        struct thread *ret = _find_thread_by_handle((void*)&cur);
-        if (ret != NULL)
-                return ret->ID;
+        if (self_thread != NULL)
+                return self_thread->ID;
         return -1;
 }
 
+thread_t* rune_thread_current(void) {
+        return self_thread;
+}
+
 void rune_thread_exit(void *retval) {
-        pthread_t cur = pthread_self();
-        struct thread *self = _find_thread_by_handle((void*)&cur);
-        log_output(LOG_DEBUG, "Thread %d called thread_exit", self->ID);
+        log_output(LOG_DEBUG, "Thread %d called thread_exit", rune_thread_self());
         pthread_exit(retval);
 }
 
+static struct thread* _find_existing_thread(int ID) {
+        struct thread *thread = self_thread;
+        if (thread == NULL || thread->ID != ID)
+                thread = _find_thread_by_id(ID);
+        if (thread == NULL)
+                log_output(LOG_ERROR, "Thread %d does not exist", ID);
+        return thread;
+}
+
+static int _find_pthread(int ID, pthread_t *handle) {
+        struct thread *thread = _find_existing_thread(ID);
+        if (thread == NULL)
+                return -1;
+        *handle = *(pthread_t*)thread->thread_handle;
+        return 0;
+}
+
+static int _set_nice(struct thread *thread, int nice) {
+#ifdef __linux__
+        int tid;
+        while ((tid = atomic_load(&thread->os_id)) == 0)
+                sched_yield();
+        if (setpriority(PRIO_PROCESS, tid, nice) != 0)
+                return errno;
+        return 0;
+#else
+        (void)thread;
+        (void)nice;
+        return 0;
+#endif
+}
+
+int rune_thread_set_affinity(int ID, const int *cpus, int count) {
+        pthread_t handle;
+        if (_find_pthread(ID, &handle) != 0)
+                return -1;
+
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (count == 0) {
+                const cpu_topology_t *topology = rune_cpu_topology();
+                for (int i = 0; i < topology->num_cpus; i++)
+                        CPU_SET(topology->cpus[i].id, &set);
+        }
+        for (int i = 0; i < count; i++)
+                CPU_SET(cpus[i], &set);
+
+        int retval = pthread_setaffinity_np(handle, sizeof(set), &set);
+        if (retval != 0) {
+                log_output(LOG_ERROR, "Cannot set affinity of thread %d: %s", ID, strerror(retval));
+                return -1;
+        }
+        return 0;
+#else
+        (void)cpus;
+        (void)count;
+        log_output(LOG_WARN, "Thread affinity is not supported on this platform");
+        return -1;
+#endif
+}
+
+int rune_thread_set_priority(int ID, int priority) {
+        struct thread *thread = _find_existing_thread(ID);
+        if (thread == NULL)
+                return -1;
+
+        pthread_t handle = *(pthread_t*)thread->thread_handle;
+        int policy;
+        int nice = 0;
+        struct sched_param param = { 0 };
+        switch (priority) {
+        case THREAD_PRIORITY_LOW:
+#ifdef SCHED_IDLE
+                policy = SCHED_IDLE;
+#else
+                policy = SCHED_OTHER;
+#endif
+                break;
+        case THREAD_PRIORITY_NORMAL:
+                policy = SCHED_OTHER;
+                break;
+        case THREAD_PRIORITY_HIGH:
+                policy = SCHED_OTHER;
+                param.sched_priority = sched_get_priority_max(SCHED_OTHER);
+                nice = HIGH_PRIORITY_NICE;
+                break;
+        case THREAD_PRIORITY_REALTIME:
+                policy = SCHED_FIFO;
+                param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+                break;
+        default:
+                log_output(LOG_ERROR, "Invalid thread priority %d", priority);
+                return -1;
+        }
+
+        int retval = pthread_setschedparam(handle, policy, &param);
+        if (retval == 0 && policy == SCHED_OTHER)
+                retval = _set_nice(thread, nice);
+        if (retval != 0) {
+                log_output(LOG_ERROR, "Cannot set priority of thread %d: %s", ID, strerror(retval));
+                return -1;
+        }
+        return 0;
+}
+
+int rune_thread_set_name(int ID, const char *name) {
+        pthread_t handle;
+        if (_find_pthread(ID, &handle) != 0)
+                return -1;
+
+#ifdef __linux__
+        char buf[MAX_NAME_LEN + 1];
+        strncpy(buf, name, MAX_NAME_LEN);
+        buf[MAX_NAME_LEN] = '\0';
+        int retval = pthread_setname_np(handle, buf);
+        if (retval != 0) {
+                log_output(LOG_ERROR, "Cannot name thread %d: %s", ID, strerror(retval));
+                return -1;
+        }
+        return 0;
+#else
+        (void)name;
+        return -1;
+#endif
+}
+
+int rune_tls_alloc(void (*destructor)(void *value)) {
+        int expected;
+        for (int i = 0; i < MAX_TLS_SLOTS; i++) {
+                expected = 0;
+                if (atomic_compare_exchange_strong(&tls_slots[i].used, &expected, 1)) {
+                        tls_slots[i].destructor = destructor;
+                        return i;
+                }
+        }
+        log_output(LOG_ERROR, "Cannot allocate TLS slot, all %d are in use", MAX_TLS_SLOTS);
+        return -1;
+}
+
+void rune_tls_free(int slot) {
+        if (slot < 0 || slot >= MAX_TLS_SLOTS)
+                return;
+
+        tls_slots[slot].destructor = NULL;
+        atomic_fetch_add(&tls_slots[slot].gen, 1);
+        atomic_store(&tls_slots[slot].used, 0);
+}
+
+int rune_tls_set(int slot, void *value) {
+        if (slot < 0 || slot >= MAX_TLS_SLOTS || atomic_load_explicit(&tls_slots[slot].used, memory_order_relaxed) == 0)
+                return -1;
+
+        tls_values[slot].gen = atomic_load_explicit(&tls_slots[slot].gen, memory_order_relaxed);
+        tls_values[slot].value = value;
+        return 0;
+}
+
+void* rune_tls_get(int slot) {
+        if (slot < 0 || slot >= MAX_TLS_SLOTS)
+                return NULL;
+        if (tls_values[slot].gen != atomic_load_explicit(&tls_slots[slot].gen, memory_order_relaxed))
+                return NULL;
+        return tls_values[slot].value;
+}
+
+static void _mutex_acquire_slow(rune_mutex_t *mutex) {
+        int spin = atomic_load_explicit(&mutex->spin, memory_order_relaxed);
+        int max_spin = spin * 2 + 10;
+        if (max_spin > MAX_SPIN)
+                max_spin = MAX_SPIN;
+
+        int expected;
+        for (int i = 0; i < max_spin; i++) {
+                cpu_relax();
+                expected = MUTEX_UNLOCKED;
+                if (atomic_load_explicit(&mutex->state, memory_order_relaxed) == MUTEX_UNLOCKED
+                                && atomic_compare_exchange_weak_explicit(&mutex->state, &expected, MUTEX_LOCKED,
+                                        memory_order_acquire, memory_order_relaxed)) {
+                        atomic_store_explicit(&mutex->spin, spin + (i - spin) / 8, memory_order_relaxed);
+                        return;
+                }
+        }
+
+        atomic_store_explicit(&mutex->spin, spin + (max_spin - spin) / 8, memory_order_relaxed);
+        while (atomic_exchange_explicit(&mutex->state, MUTEX_CONTENDED, memory_order_acquire) != MUTEX_UNLOCKED)
+                futex_wait(&mutex->state, MUTEX_CONTENDED, -1);
+}
+
+rune_mutex_t* rune_mutex_new(void) {
+        if (mutex_pool == NULL) {
+                log_output(LOG_ERROR, "Cannot create mutex before rune_init_thread_api");
+                return NULL;
+        }
+
+        rune_mutex_t *ret = rune_pool_alloc(mutex_pool);
+        if (ret == NULL)
+                return NULL;
+
+        atomic_init(&ret->state, MUTEX_UNLOCKED);
+        atomic_init(&ret->spin, 0);
+        return ret;
+}
+
+void rune_mutex_free(rune_mutex_t *mutex) {
+        if (mutex == NULL)
+                return;
+
+        if (atomic_load(&mutex->state) != MUTEX_UNLOCKED)
+                log_output(LOG_WARN, "Destroying mutex %p while it is locked", mutex);
+        rune_pool_free(mutex_pool, mutex);
+}
+
+void rune_mutex_acquire(rune_mutex_t *mutex) {
+        int expected = MUTEX_UNLOCKED;
+        if (atomic_compare_exchange_strong_explicit(&mutex->state, &expected, MUTEX_LOCKED,
+                                memory_order_acquire, memory_order_relaxed))
+                return;
+        _mutex_acquire_slow(mutex);
+}
+
+int rune_mutex_try_acquire(rune_mutex_t *mutex) {
+        int expected = MUTEX_UNLOCKED;
+        if (atomic_compare_exchange_strong_explicit(&mutex->state, &expected, MUTEX_LOCKED,
+                                memory_order_acquire, memory_order_relaxed))
+                return 0;
+        return -1;
+}
+
+void rune_mutex_release(rune_mutex_t *mutex) {
+        if (atomic_exchange_explicit(&mutex->state, MUTEX_UNLOCKED, memory_order_release) == MUTEX_CONTENDED)
+                futex_wake(&mutex->state, 1);
+}
+
+static int _alloc_mutex_id(void) {
+        if (num_free_mids > 0)
+                return free_mids[--num_free_mids];
+        if (next_mid == MAX_MUTEX_IDS)
+                return -1;
+
+        int chunk = next_mid / MUTEX_CHUNK_SIZE;
+        if (atomic_load(&mutex_chunks[chunk]) == NULL) {
+                mutex_slot_t *slots = rune_calloc_tagged(0, sizeof(mutex_slot_t) * MUTEX_CHUNK_SIZE, MEM_TAG_THREAD);
+                if (slots == NULL)
+                        return -1;
+                atomic_store_explicit(&mutex_chunks[chunk], slots, memory_order_release);
+        }
+        return next_mid++;
+}
+
 int rune_mutex_init(void) {
-        struct mutex *mutex = rune_alloc(sizeof(struct mutex));
-        mutex->ID = next_mid++;
-        mutex->mutex_handle = rune_alloc(sizeof(pthread_mutex_t));
-        pthread_mutex_init((pthread_mutex_t*)mutex->mutex_handle, NULL);
-        if (mutexes == NULL)
-                mutexes = &mutex->list;
-        else
-                list_add(&mutex->list, mutexes);
-        return mutex->ID;
+        rune_mutex_t *mutex = rune_mutex_new();
+        if (mutex == NULL)
+                return -1;
+
+        rune_mutex_acquire(&registry_lock);
+        int ID = _alloc_mutex_id();
+        if (ID != -1)
+                atomic_store_explicit(_find_mutex_slot(ID), mutex, memory_order_release);
+        rune_mutex_release(&registry_lock);
+        if (ID == -1) {
+                log_output(LOG_ERROR, "Cannot create mutex, all %d IDs are in use", MAX_MUTEX_IDS);
+                rune_mutex_free(mutex);
+        }
+        return ID;
 }
 
 int rune_mutex_destroy(int ID) {
-        struct mutex *mutex = _find_mutex_by_id(ID);
-        rune_free(mutex->mutex_handle);
-        if (&mutex->list != mutexes)
-                list_del(&mutex->list);
-        rune_free(mutex);
+        mutex_slot_t *slot = _find_mutex_slot(ID);
+        rune_mutex_t *mutex = slot != NULL ? atomic_exchange(slot, NULL) : NULL;
+        if (mutex == NULL) {
+                log_output(LOG_ERROR, "Mutex %d does not exist", ID);
+                return -1;
+        }
+
+        rune_mutex_acquire(&registry_lock);
+        free_mids[num_free_mids++] = ID;
+        rune_mutex_release(&registry_lock);
+        rune_mutex_free(mutex);
+        return 0;
 }
 
 int rune_mutex_lock(int ID) {
-        struct mutex *mutex = _find_mutex_by_id(ID);
-        int retval = pthread_mutex_lock((pthread_mutex_t*)mutex->mutex_handle);
-        if (retval != 0) {
-                char *str = strerror(retval);
-                log_output(LOG_ERROR, "Cannot lock mutex %d: %s", mutex->ID, str);
+        rune_mutex_t *mutex = _find_mutex_by_id(ID);
+        if (mutex == NULL) {
+                log_output(LOG_ERROR, "Cannot lock mutex %d, does not exist", ID);
+                return -1;
         }
+        rune_mutex_acquire(mutex);
+        return 0;
 }
 
 int rune_mutex_unlock(int ID) {
-        struct mutex *mutex = _find_mutex_by_id(ID);
-        int retval = pthread_mutex_unlock((pthread_mutex_t*)mutex->mutex_handle);
-        if (retval != 0) {
-                char *str = strerror(retval);
-                log_output(LOG_ERROR, "Cannot unlock mutex %d: %s", mutex->ID, str);
+        rune_mutex_t *mutex = _find_mutex_by_id(ID);
+        if (mutex == NULL) {
+                log_output(LOG_ERROR, "Cannot unlock mutex %d, does not exist", ID);
+                return -1;
         }
+        rune_mutex_release(mutex);
+        return 0;
 }
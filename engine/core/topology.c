@@ -0,0 +1,241 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/core/thread.h>
+#include <rune/core/logging.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+#define MAX_CPUS        1024
+#define SYSFS_CPU       "/sys/devices/system/cpu"
+#define SYSFS_NODE      "/sys/devices/system/node"
+
+/*
+ * Topology is read from sysfs once and kept in static storage, so the
+ * pointer handed out stays valid even after rune_free_all. Cores and L3
+ * groups are identified by the lowest CPU in their sibling list and then
+ * renumbered densely in order of discovery.
+ */
+static cpu_info_t cpus[MAX_CPUS];
+static cpu_topology_t topology = { 0, 0, 0, 0, cpus };
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+#ifdef __linux__
+static int _read_line(const char *path, char *buf, size_t sz) {
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+                return -1;
+
+        char *ret = fgets(buf, sz, file);
+        fclose(file);
+        if (ret == NULL)
+                return -1;
+        buf[strcspn(buf, "\n")] = '\0';
+        return 0;
+}
+
+static int _read_int(const char *path, int *value) {
+        char buf[32];
+        if (_read_line(path, buf, sizeof(buf)) != 0)
+                return -1;
+        *value = atoi(buf);
+        return 0;
+}
+
+static int _parse_cpulist(const char *list, int *out, int max) {
+        int count = 0;
+        char *end;
+        long first, last;
+        while (*list != '\0') {
+                first = strtol(list, &end, 10);
+                if (end == list)
+                        break;
+                last = first;
+                if (*end == '-') {
+                        list = end + 1;
+                        last = strtol(list, &end, 10);
+                }
+                for (long i = first; i <= last && count < max; i++)
+                        out[count++] = (int)i;
+                list = *end == ',' ? end + 1 : end;
+        }
+        return count;
+}
+
+static int _first_in_cpulist(const char *path) {
+        char buf[4096];
+        int first;
+        if (_read_line(path, buf, sizeof(buf)) != 0)
+                return -1;
+        if (_parse_cpulist(buf, &first, 1) != 1)
+                return -1;
+        return first;
+}
+
+static int _find_cpu(int id) {
+        for (int i = 0; i < topology.num_cpus; i++) {
+                if (cpus[i].id == id)
+                        return i;
+        }
+        return -1;
+}
+
+static int _dense_index(int *keys, int *num_keys, int key) {
+        for (int i = 0; i < *num_keys; i++) {
+                if (keys[i] == key)
+                        return i;
+        }
+        keys[*num_keys] = key;
+        return (*num_keys)++;
+}
+
+static int _find_l3(int cpu) {
+        char path[128];
+        int level;
+        for (int i = 0; ; i++) {
+                snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, i);
+                if (_read_int(path, &level) != 0)
+                        return -1;
+                if (level != 3)
+                        continue;
+                snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+                return _first_in_cpulist(path);
+        }
+}
+
+static void _read_nodes(void) {
+        DIR *dir = opendir(SYSFS_NODE);
+        if (dir == NULL)
+                return;
+
+        static int list[MAX_CPUS];
+        char path[300];
+        char buf[4096];
+        struct dirent *entry;
+        int node, count, idx;
+        while ((entry = readdir(dir)) != NULL) {
+                if (strncmp(entry->d_name, "node", 4) != 0 || sscanf(entry->d_name + 4, "%d", &node) != 1)
+                        continue;
+                snprintf(path, sizeof(path), SYSFS_NODE "/%s/cpulist", entry->d_name);
+                if (_read_line(path, buf, sizeof(buf)) != 0)
+                        continue;
+                count = _parse_cpulist(buf, list, MAX_CPUS);
+                for (int i = 0; i < count; i++) {
+                        idx = _find_cpu(list[i]);
+                        if (idx >= 0)
+                                cpus[idx].node = node;
+                }
+                if (count > 0)
+                        topology.num_nodes++;
+        }
+        closedir(dir);
+}
+
+static int _read_sysfs(void) {
+        static int online[MAX_CPUS];
+        static int core_keys[MAX_CPUS];
+        static int l3_keys[MAX_CPUS];
+        static int core_smt[MAX_CPUS];
+        char buf[4096];
+        char path[128];
+        if (_read_line(SYSFS_CPU "/online", buf, sizeof(buf)) != 0)
+                return -1;
+
+        int count = _parse_cpulist(buf, online, MAX_CPUS);
+        if (count == 0)
+                return -1;
+
+        int num_l3 = 0;
+        int first, package;
+        for (int i = 0; i < count; i++) {
+                cpus[i].id = online[i];
+
+                snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_cpus_list", online[i]);
+                first = _first_in_cpulist(path);
+                if (first < 0) {
+                        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", online[i]);
+                        first = _first_in_cpulist(path);
+                }
+                if (first < 0)
+                        first = online[i];
+                cpus[i].core = _dense_index(core_keys, &topology.num_cores, first);
+                cpus[i].smt = core_smt[cpus[i].core]++;
+
+                snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", online[i]);
+                cpus[i].package = _read_int(path, &package) == 0 ? package : 0;
+
+                first = _find_l3(online[i]);
+                cpus[i].l3 = _dense_index(l3_keys, &num_l3, first);
+                cpus[i].node = 0;
+        }
+
+        topology.num_cpus = count;
+        topology.num_l3 = num_l3;
+        _read_nodes();
+        if (topology.num_nodes == 0)
+                topology.num_nodes = 1;
+        return 0;
+}
+#endif
+
+static void _detect_topology(void) {
+#ifdef __linux__
+        if (_read_sysfs() == 0)
+                goto done;
+        log_output(LOG_WARN, "Cannot read CPU topology from sysfs, assuming one core per CPU");
+#endif
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        if (count <= 0)
+                count = 1;
+        if (count > MAX_CPUS)
+                count = MAX_CPUS;
+
+        for (int i = 0; i < count; i++) {
+                cpus[i].id = i;
+                cpus[i].core = i;
+                cpus[i].smt = 0;
+                cpus[i].package = 0;
+                cpus[i].l3 = 0;
+                cpus[i].node = 0;
+        }
+        topology.num_cpus = count;
+        topology.num_cores = count;
+        topology.num_l3 = 1;
+        topology.num_nodes = 1;
+
+#ifdef __linux__
+done:
+#endif
+        log_output(LOG_INFO, "Detected %d CPUs, %d cores, %d L3 groups, %d NUMA nodes",
+                        topology.num_cpus, topology.num_cores, topology.num_l3, topology.num_nodes);
+}
+
+const cpu_topology_t* rune_cpu_topology(void) {
+        pthread_once(&topology_once, _detect_topology);
+        return &topology;
+}
@@ -0,0 +1,177 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <rune/render/renderer.h>
+#include <rune/core/thread.h>
+#include <rune/core/logging.h>
+#include <rune/core/alloc.h>
+#include <stdatomic.h>
+
+#define NUM_PACKETS     2
+#define PACKET_ALIGN    16
+
+/*
+ * Packets alternate between the submitting thread and the render thread.
+ * free_packets counts packets the game may fill and ready_packets counts
+ * packets waiting to be drawn; each side only ever touches its own index,
+ * so the semaphores are the only synchronization. Closing posts one extra
+ * ready token, which the render thread recognizes because no packet is
+ * pending when it arrives.
+ *
+ * Frame arenas are reset here on the producing side when a packet is
+ * acquired, so rune_frame_alloc during simulation always sees the arena of
+ * the packet being filled. The render thread never resets an arena.
+ */
+static renderer_t *renderer = NULL;
+static render_packet_t packets[NUM_PACKETS];
+static int num_packets = 0;
+static int write_idx = 0;
+static int read_idx = 0;
+static uint64_t next_frame = 0;
+
+static int render_thread = -1;
+static rune_sem_t *free_packets = NULL;
+static rune_sem_t *ready_packets = NULL;
+static atomic_int pending = 0;
+
+static void* _render_main(void *data) {
+        render_packet_t *packet;
+        for (;;) {
+                rune_sem_wait(ready_packets);
+                if (atomic_load(&pending) == 0)
+                        break;
+
+                packet = &packets[read_idx];
+                renderer->draw_packet(packet);
+                read_idx = (read_idx + 1) % num_packets;
+                atomic_fetch_sub(&pending, 1);
+                rune_sem_post(free_packets, 1);
+        }
+        return NULL;
+}
+
+static void _free_packets(void) {
+        for (int i = 0; i < num_packets; i++) {
+                rune_free(packets[i].data);
+                packets[i].data = NULL;
+                packets[i].capacity = 0;
+        }
+        num_packets = 0;
+        rune_sem_free(free_packets);
+        rune_sem_free(ready_packets);
+        free_packets = NULL;
+        ready_packets = NULL;
+}
+
+int rune_render_pipeline_init(renderer_t *r, size_t packet_size, int threaded) {
+        if (r == NULL || r->draw_packet == NULL) {
+                log_output(LOG_ERROR, "Renderer cannot draw frame packets");
+                return -1;
+        }
+
+        threaded = threaded != 0;
+        if (threaded == 1 && rune_frame_count() == 1) {
+                log_output(LOG_ERROR, "Render thread needs at least two frame arenas");
+                return -1;
+        }
+
+        renderer = r;
+        num_packets = threaded == 1 ? NUM_PACKETS : 1;
+        for (int i = 0; i < num_packets; i++) {
+                packets[i].frame = 0;
+                packets[i].time = 0;
+                packets[i].size = 0;
+                packets[i].data = rune_alloc_aligned_tagged(packet_size, PACKET_ALIGN, MEM_TAG_RENDER);
+                if (packets[i].data == NULL) {
+                        log_output(LOG_ERROR, "Cannot allocate render packet of %zu bytes", packet_size);
+                        num_packets = i;
+                        _free_packets();
+                        return -1;
+                }
+                packets[i].capacity = packet_size;
+        }
+        write_idx = 0;
+        read_idx = 0;
+        if (threaded == 0)
+                return 0;
+
+        free_packets = rune_sem_new(NUM_PACKETS);
+        ready_packets = rune_sem_new(0);
+        if (free_packets == NULL || ready_packets == NULL) {
+                _free_packets();
+                return -1;
+        }
+
+        atomic_store(&pending, 0);
+        render_thread = rune_thread_init(_render_main, NULL, 0);
+        if (render_thread == -1) {
+                log_output(LOG_ERROR, "Cannot start render thread");
+                _free_packets();
+                return -1;
+        }
+        rune_thread_set_name(render_thread, "rune-render");
+        log_output(LOG_INFO, "Started render thread with %d packets of %zu bytes", NUM_PACKETS, packet_size);
+        return 0;
+}
+
+void rune_render_pipeline_close(void) {
+        if (render_thread != -1) {
+                rune_sem_post(ready_packets, 1);
+                rune_thread_join(render_thread, NULL);
+                render_thread = -1;
+                log_output(LOG_INFO, "Stopped render thread");
+        }
+        _free_packets();
+        renderer = NULL;
+}
+
+render_packet_t* rune_render_acquire_packet(void) {
+        if (num_packets == 0)
+                return NULL;
+
+        if (render_thread != -1)
+                rune_sem_wait(free_packets);
+        render_packet_t *packet = &packets[write_idx];
+        write_idx = (write_idx + 1) % num_packets;
+        packet->frame = next_frame++;
+        packet->size = 0;
+        rune_frame_begin(packet->frame);
+        return packet;
+}
+
+void rune_render_submit_packet(render_packet_t *packet) {
+        if (render_thread == -1) {
+                renderer->draw_packet(packet);
+                return;
+        }
+
+        atomic_fetch_add(&pending, 1);
+        rune_sem_post(ready_packets, 1);
+}
+
+void* rune_render_packet_alloc(render_packet_t *packet, size_t sz) {
+        size_t offset = (packet->size + PACKET_ALIGN - 1) & ~(size_t)(PACKET_ALIGN - 1);
+        if (offset + sz > packet->capacity)
+                return NULL;
+
+        packet->size = offset + sz;
+        return (uint8_t*)packet->data + offset;
+}
@@ -27,27 +27,42 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define DEBUG_RATELIMIT_SLOTS 64
+
+/*
+ * Validation messages are rate limited by their message ID, so repeats of
+ * one problem are throttled no matter how the text varies. IDs that land
+ * in the same slot share a budget.
+ */
+static log_ratelimit_t debug_ratelimits[DEBUG_RATELIMIT_SLOTS];
+
 VKAPI_ATTR VkBool32 VKAPI_CALL _vulkan_db_callback(
                 VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
                 VkDebugUtilsMessageTypeFlagsEXT message_types,
                 const VkDebugUtilsMessengerCallbackDataEXT *callback_data,
                 void *user_data) {
+        int level;
         switch (message_severity) {
                 case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
-                        log_output(LOG_ERROR, callback_data->pMessage);
+                        level = LOG_ERROR;
                         break;
                 case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
-                        log_output(LOG_WARN, callback_data->pMessage);
+                        level = LOG_WARN;
                         break;
                 case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
-                        log_output(LOG_INFO, callback_data->pMessage);
+                        level = LOG_INFO;
                         break;
                 case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
-                        log_output(LOG_DEBUG, callback_data->pMessage);
+                        level = LOG_DEBUG;
                         break;
                 default:
-                        break;
+                        return VK_FALSE;
         }
+
+        log_ratelimit_t *limit = &debug_ratelimits[(uint32_t)callback_data->messageIdNumber % DEBUG_RATELIMIT_SLOTS];
+        if (rune_log_enabled(level) && rune_log_ratelimit(limit, level, __FILE__, __LINE__,
+                                LOG_RATELIMIT_BURST, LOG_RATELIMIT_INTERVAL))
+                log_output(level, "%s", callback_data->pMessage);
         return VK_FALSE;
 }
 
@@ -111,8 +126,8 @@ uint32_t _vertoi(const char *version) {
 }
 
 vkcontext_t* create_vkcontext(vklayer_container_t *vklayers, ext_container_t *ext) {
-        vkcontext_t *ret = rune_calloc(0, sizeof(vkcontext_t));
-        ret->surface = rune_alloc(sizeof(vksurface_t));
+        vkcontext_t *ret = rune_calloc_tagged(0, sizeof(vkcontext_t), MEM_TAG_RENDER);
+        ret->surface = rune_alloc_tagged(sizeof(vksurface_t), MEM_TAG_RENDER);
 
         VkApplicationInfo app_info;
         app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -174,7 +189,7 @@ void destroy_vkcontext(vkcontext_t *context) {
 
 vklayer_container_t* init_vklayers(ext_container_t *ext) {
         ext->ext_count++;
-        const char** new_extensions = rune_alloc(sizeof(char*) * ext->ext_count);
+        const char** new_extensions = rune_alloc_tagged(sizeof(char*) * ext->ext_count, MEM_TAG_RENDER);
         if (new_extensions == NULL) {
                 log_output(LOG_FATAL, "Cannot allocate memory for debug extensions");
                 rune_abort();
@@ -190,9 +205,9 @@ vklayer_container_t* init_vklayers(ext_container_t *ext) {
         VkLayerProperties layer_props[layer_count];
         vkEnumerateInstanceLayerProperties(&layer_count, layer_props);
 
-        vklayer_container_t *ret = rune_alloc(sizeof(vklayer_container_t));
+        vklayer_container_t *ret = rune_alloc_tagged(sizeof(vklayer_container_t), MEM_TAG_RENDER);
         ret->vklayer_count = 1;
-        ret->vklayer_names = rune_alloc(sizeof(char*) * ret->vklayer_count);
+        ret->vklayer_names = rune_alloc_tagged(sizeof(char*) * ret->vklayer_count, MEM_TAG_RENDER);
         ret->vklayer_names[0] = "VK_LAYER_KHRONOS_validation";
 
         for (uint32_t i = 0; i < ret->vklayer_count; i++) {
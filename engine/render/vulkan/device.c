@@ -46,7 +46,7 @@ void _query_pdev_data(VkPhysicalDevice pdev, struct vkdev_data *pdata) {
 uint32_t _query_qfam_data(VkSurfaceKHR surface, VkPhysicalDevice pdev, VkQueueFamilyProperties** qfam_props) {
         uint32_t count;
         vkGetPhysicalDeviceQueueFamilyProperties(pdev, &count, NULL);
-        *qfam_props = rune_alloc(sizeof(VkQueueFamilyProperties) * count);
+        *qfam_props = rune_alloc_tagged(sizeof(VkQueueFamilyProperties) * count, MEM_TAG_RENDER);
         vkGetPhysicalDeviceQueueFamilyProperties(pdev, &count, *qfam_props);
         return count;
 }
@@ -149,7 +149,7 @@ void _create_queue(vkdev_t *dev, int qfam_type, int qfam_index, int queue_index)
                 case QFAM_TYPE_PRESENT:
                         if (dev->pres_queue != NULL)
                                 rune_free(dev->pres_queue);
-                        dev->pres_queue = rune_alloc(sizeof(VkQueue));
+                        dev->pres_queue = rune_alloc_tagged(sizeof(VkQueue), MEM_TAG_RENDER);
                         queue_arr = dev->pres_queue;
                         break;
                 default:
@@ -171,7 +171,7 @@ vkdev_t* create_vkdev(VkInstance instance, VkSurfaceKHR surface, int num_gfx, in
                 rune_abort();
         }
 
-        vkdev_t *dev = rune_calloc(0, sizeof(vkdev_t));
+        vkdev_t *dev = rune_calloc_tagged(0, sizeof(vkdev_t), MEM_TAG_RENDER);
         dev->pdev = pdev;
         dev->gfx_qfam = gfx_qfam;
         dev->tsfr_qfam = tsfr_qfam;
@@ -197,7 +197,7 @@ vkdev_t* create_vkdev(VkInstance instance, VkSurfaceKHR surface, int num_gfx, in
 
         int num_total = num_gfx + num_tsfr + num_comp;
         static const float queue_priority = 1.0f;
-        VkDeviceQueueCreateInfo *qcinfos = rune_calloc(0, sizeof(VkDeviceQueueCreateInfo)*3);
+        VkDeviceQueueCreateInfo *qcinfos = rune_calloc_tagged(0, sizeof(VkDeviceQueueCreateInfo)*3, MEM_TAG_RENDER);
         for (int i = 0; i < 3; i++) {
                 qcinfos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
                 qcinfos[i].pNext = NULL;
@@ -274,11 +274,11 @@ void get_swapchain_data(vkdev_t *dev, VkSurfaceKHR *surface) {
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(dev->pdev, *surface, &dev->scdata.capabilities);
 
         vkGetPhysicalDeviceSurfaceFormatsKHR(dev->pdev, *surface, &dev->scdata.format_count, NULL);
-        dev->scdata.formats = rune_alloc(sizeof(VkSurfaceFormatKHR) * dev->scdata.format_count);
+        dev->scdata.formats = rune_alloc_tagged(sizeof(VkSurfaceFormatKHR) * dev->scdata.format_count, MEM_TAG_RENDER);
         vkGetPhysicalDeviceSurfaceFormatsKHR(dev->pdev, *surface, &dev->scdata.format_count, dev->scdata.formats);
 
         vkGetPhysicalDeviceSurfacePresentModesKHR(dev->pdev, *surface, &dev->scdata.present_count, NULL);
-        dev->scdata.present_modes = rune_alloc(sizeof(VkPresentModeKHR) * dev->scdata.present_count);
+        dev->scdata.present_modes = rune_alloc_tagged(sizeof(VkPresentModeKHR) * dev->scdata.present_count, MEM_TAG_RENDER);
         vkGetPhysicalDeviceSurfacePresentModesKHR(dev->pdev, *surface, &dev->scdata.present_count, dev->scdata.present_modes);
 }
 
@@ -24,8 +24,15 @@
 #include <rune/core/logging.h>
 #include <rune/core/alloc.h>
 
+#define FENCE_POOL_SIZE 8
+
+static mem_pool_t *fence_pool = NULL;
+
 vkfence_t* create_vkfence(vkdev_t *dev, uint8_t signal) {
-        vkfence_t *ret = rune_alloc(sizeof(vkfence_t));
+        if (fence_pool == NULL)
+                fence_pool = rune_pool_create_tagged(sizeof(vkfence_t), FENCE_POOL_SIZE, MEM_TAG_RENDER);
+
+        vkfence_t *ret = rune_pool_alloc(fence_pool);
         
         VkFenceCreateInfo fcinfo;
         fcinfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
@@ -43,7 +50,12 @@ void destroy_vkfence(vkfence_t *fence, vkdev_t *dev) {
                 vkDestroyFence(dev->ldev, fence->handle, NULL);
                 fence->handle = NULL;
         }
-        rune_free(fence);
+        rune_pool_free(fence_pool, fence);
+}
+
+void destroy_vkfence_pool(void) {
+        rune_pool_destroy(fence_pool);
+        fence_pool = NULL;
 }
 
 int fence_lock(vkfence_t *fence, vkdev_t *dev, uint64_t timeout) {
@@ -56,7 +68,7 @@ int fence_lock(vkfence_t *fence, vkdev_t *dev, uint64_t timeout) {
                         fence->signal = 1;
                         return 0;
                 case VK_TIMEOUT:
-                        log_output(LOG_WARN, "Vulkan fence timed out");
+                        RLOG_LIMITED(LOG_WARN, "Vulkan fence timed out");
                         break;
                 case VK_ERROR_DEVICE_LOST:
                         log_output(LOG_ERROR, "Lost access to host device");
@@ -26,6 +26,7 @@
 
 vkfence_t* create_vkfence(vkdev_t *dev, uint8_t signal);
 void destroy_vkfence(vkfence_t *fence, vkdev_t *dev);
+void destroy_vkfence_pool(void);
 
 int fence_lock(vkfence_t *fence, vkdev_t *dev, uint64_t timeout);
 void fence_unlock(vkfence_t *fence, vkdev_t *dev);
@@ -24,10 +24,17 @@
 #include <rune/core/alloc.h>
 #include <rune/core/logging.h>
 
+#define FRAMEBUFFER_POOL_SIZE   8
+
+static mem_pool_t *framebuffer_pool = NULL;
+
 vkframebuffer_t* create_vkframebuffer(vkdev_t *dev, vkrendpass_t *rendpass, uint32_t width, uint32_t height, uint32_t at_count, VkImageView *at) {
-        vkframebuffer_t *ret = rune_alloc(sizeof(vkframebuffer_t));
+        if (framebuffer_pool == NULL)
+                framebuffer_pool = rune_pool_create_tagged(sizeof(vkframebuffer_t), FRAMEBUFFER_POOL_SIZE, MEM_TAG_RENDER);
+
+        vkframebuffer_t *ret = rune_pool_alloc(framebuffer_pool);
         ret->at_count = at_count;
-        ret->attachments = rune_alloc(sizeof(VkImageView) * at_count);
+        ret->attachments = rune_alloc_tagged(sizeof(VkImageView) * at_count, MEM_TAG_RENDER);
         for (uint32_t i = 0; i < at_count; i++)
                 ret->attachments[i] = at[i];
         ret->rendpass = rendpass;
@@ -51,5 +58,10 @@ void destroy_vkframebuffer(vkframebuffer_t *framebuffer, vkdev_t *dev) {
         vkDestroyFramebuffer(dev->ldev, framebuffer->handle, NULL);
         if (framebuffer->attachments)
                 rune_free(framebuffer->attachments);
-        rune_free(framebuffer);
+        rune_pool_free(framebuffer_pool, framebuffer);
+}
+
+void destroy_vkframebuffer_pool(void) {
+        rune_pool_destroy(framebuffer_pool);
+        framebuffer_pool = NULL;
 }
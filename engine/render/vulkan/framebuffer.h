@@ -26,5 +26,6 @@
 
 vkframebuffer_t* create_vkframebuffer(vkdev_t *dev, vkrendpass_t *rendpass, uint32_t width, uint32_t height, uint32_t at_count, VkImageView *at);
 void destroy_vkframebuffer(vkframebuffer_t *framebuffer, vkdev_t *dev);
+void destroy_vkframebuffer_pool(void);
 
 #endif
@@ -24,6 +24,10 @@
 #include "vkassert.h"
 #include <rune/core/alloc.h>
 
+#define IMAGE_POOL_SIZE 8
+
+static mem_pool_t *image_pool = NULL;
+
 int _create_image_view(vkimage_t *image, vkdev_t *dev, VkFormat format, VkImageAspectFlags aflags) {
         VkImageViewCreateInfo vcinfo;
         vcinfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -45,7 +49,10 @@ int _create_image_view(vkimage_t *image, vkdev_t *dev, VkFormat format, VkImageA
 }
 
 vkimage_t* create_vkimage(vkdev_t *dev, VkFormat format, uint32_t width, uint32_t height, uint32_t usage, uint32_t mem_flags, uint32_t aflags, int create_view) {
-        vkimage_t *ret = rune_alloc(sizeof(vkimage_t));
+        if (image_pool == NULL)
+                image_pool = rune_pool_create_tagged(sizeof(vkimage_t), IMAGE_POOL_SIZE, MEM_TAG_RENDER);
+
+        vkimage_t *ret = rune_pool_alloc(image_pool);
         ret->width = width;
         ret->height = height;
 
@@ -95,5 +102,10 @@ void destroy_vkimage(vkimage_t *image, vkdev_t *dev) {
                 vkFreeMemory(dev->ldev, image->memory, NULL);
         if (image->handle)
                 vkDestroyImage(dev->ldev, image->handle, NULL);
-        rune_free(image);
+        rune_pool_free(image_pool, image);
+}
+
+void destroy_vkimage_pool(void) {
+        rune_pool_destroy(image_pool);
+        image_pool = NULL;
 }
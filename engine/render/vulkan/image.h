@@ -26,5 +26,6 @@
 
 vkimage_t* create_vkimage(vkdev_t *dev, VkFormat format, uint32_t width, uint32_t height, uint32_t usage, uint32_t mem_flags, uint32_t aflags, int create_view);
 void destroy_vkimage(vkimage_t *image, vkdev_t *dev);
+void destroy_vkimage_pool(void);
 
 #endif
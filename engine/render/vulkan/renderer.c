@@ -35,12 +35,14 @@
 #include <rune/core/config.h>
 #include <sys/time.h>
 
+#define FRAME_ARENA_SIZE        (4 << 20)
+
 static vkcontext_t *context = NULL;
 
 void _init_cmdbuffers(void) {
         uint32_t num_buffers = context->swapchain->img_count;
         if (context->cmdbuffers == NULL)
-                context->cmdbuffers = rune_calloc(0, sizeof(vkcmdbuffer_t*) * num_buffers);
+                context->cmdbuffers = rune_calloc_tagged(0, sizeof(vkcmdbuffer_t*) * num_buffers, MEM_TAG_RENDER);
 
         for (uint32_t i = 0; i < num_buffers; i++) {
                 if (context->cmdbuffers[i] != NULL)
@@ -64,7 +66,7 @@ void _destroy_cmdbuffers(void) {
 void _init_framebuffers(void) {
         uint32_t num_buffers = context->swapchain->img_count;
         if (context->framebuffers == NULL)
-                context->framebuffers = rune_calloc(0, sizeof(vkframebuffer_t*) * num_buffers);
+                context->framebuffers = rune_calloc_tagged(0, sizeof(vkframebuffer_t*) * num_buffers, MEM_TAG_RENDER);
 
         uint32_t at_count = 2;
         for (uint32_t i = 0; i < num_buffers; i++) {
@@ -146,9 +148,9 @@ int _init_vulkan(window_t *window) {
         _init_framebuffers();
         _init_cmdbuffers();
 
-        context->image_semaphores = rune_alloc(sizeof(VkSemaphore) * context->swapchain->max_frames);
-        context->queue_semaphores = rune_alloc(sizeof(VkSemaphore) * context->swapchain->max_frames);
-        context->fences_in_flight = rune_calloc(0, sizeof(vkfence_t*) * context->swapchain->max_frames);
+        context->image_semaphores = rune_alloc_tagged(sizeof(VkSemaphore) * context->swapchain->max_frames, MEM_TAG_RENDER);
+        context->queue_semaphores = rune_alloc_tagged(sizeof(VkSemaphore) * context->swapchain->max_frames, MEM_TAG_RENDER);
+        context->fences_in_flight = rune_calloc_tagged(0, sizeof(vkfence_t*) * context->swapchain->max_frames, MEM_TAG_RENDER);
 
         VkSemaphoreCreateInfo scinfo;
         for (uint8_t i = 0; i < context->swapchain->max_frames; i++) {
@@ -159,7 +161,9 @@ int _init_vulkan(window_t *window) {
                 vkCreateSemaphore(context->dev->ldev, &scinfo, NULL, &context->queue_semaphores[i]);
                 context->fences_in_flight[i] = create_vkfence(context->dev, 1);
         }
-        context->images_in_flight = rune_calloc(0, sizeof(vkfence_t*) * context->swapchain->img_count);
+        context->images_in_flight = rune_calloc_tagged(0, sizeof(vkfence_t*) * context->swapchain->img_count, MEM_TAG_RENDER);
+        if (rune_frame_alloc_init(context->swapchain->max_frames, FRAME_ARENA_SIZE) != 0)
+                return -1;
 
         gettimeofday(&stop, NULL);
         log_output(LOG_INFO, "Finished initializing Vulkan in %lums", (stop.tv_sec - start.tv_sec) * 1000000 + stop.tv_usec - start.tv_usec);
@@ -176,21 +180,29 @@ void _close_vulkan(void) {
                 destroy_vkfence(context->fences_in_flight[i], context->dev);
         }
 
+        rune_frame_alloc_close();
         _destroy_cmdbuffers();
         _destroy_framebuffers();
         destroy_vkrendpass(context->rendpass, context->dev);
         destroy_swapchain(context->swapchain, context->dev);
+        destroy_vkcmdbuffer_pool();
+        destroy_vkframebuffer_pool();
+        destroy_vkimage_pool();
+        destroy_vkfence_pool();
         destroy_vkdev(context->dev);
         destroy_vkcontext(context);
 }
 
-int _begin_frame(float time) {
+int _begin_frame(float time, int reset_arena) {
         vkfence_t *frame_fence = context->fences_in_flight[context->swapchain->frame];
         if (fence_lock(frame_fence, context->dev, UINT64_MAX) == -1) {
                 log_output(LOG_WARN, "Error locking in-flight fence");
                 return -1;
         }
-        
+        if (reset_arena == 1)
+                rune_frame_begin(context->swapchain->frame);
+        rune_mem_tick();
+
         uint32_t next_img = vkswapchain_get_next_img(context->swapchain,
                                                      context->dev,
                                                      UINT64_MAX,
@@ -261,18 +273,25 @@ int _end_frame(float time) {
 }
 
 void _draw_vulkan(void) {
-        _begin_frame(0);
+        _begin_frame(0, 1);
         _end_frame(0);
 }
 
+void _draw_packet_vulkan(const render_packet_t *packet) {
+        if (_begin_frame(packet->time, 0) != 0)
+                return;
+        _end_frame(packet->time);
+}
+
 void _clear_vulkan(void) {
 }
 
 renderer_t* select_render_vulkan(window_t *window) {
-        renderer_t *ret = rune_alloc(sizeof(renderer_t));
+        renderer_t *ret = rune_alloc_tagged(sizeof(renderer_t), MEM_TAG_RENDER);
         ret->close = _close_vulkan;
         ret->draw = _draw_vulkan;
         ret->clear = _clear_vulkan;
+        ret->draw_packet = _draw_packet_vulkan;
         if (_init_vulkan(window) != 0)
                 rune_abort();
         return ret;
@@ -22,9 +22,18 @@
 #include "renderpass.h"
 #include "vkassert.h"
 #include <rune/core/alloc.h>
+#include <string.h>
+
+#define CMDBUF_POOL_SIZE        8
+
+static mem_pool_t *cmdbuf_pool = NULL;
 
 vkcmdbuffer_t* create_vkcmdbuffer(vkdev_t *dev, int primary) {
-        vkcmdbuffer_t *ret = rune_calloc(0, sizeof(vkcmdbuffer_t));
+        if (cmdbuf_pool == NULL)
+                cmdbuf_pool = rune_pool_create_tagged(sizeof(vkcmdbuffer_t), CMDBUF_POOL_SIZE, MEM_TAG_RENDER);
+
+        vkcmdbuffer_t *ret = rune_pool_alloc(cmdbuf_pool);
+        memset(ret, 0, sizeof(vkcmdbuffer_t));
 
         VkCommandBufferAllocateInfo ainfo;
         ainfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -43,7 +52,12 @@ vkcmdbuffer_t* create_vkcmdbuffer(vkdev_t *dev, int primary) {
 
 void destroy_vkcmdbuffer(vkcmdbuffer_t *cmdbuffer, vkdev_t *dev) {
         vkFreeCommandBuffers(dev->ldev, dev->gfx_cmd_pool, 1, &cmdbuffer->handle);
-        rune_free(cmdbuffer);
+        rune_pool_free(cmdbuf_pool, cmdbuffer);
+}
+
+void destroy_vkcmdbuffer_pool(void) {
+        rune_pool_destroy(cmdbuf_pool);
+        cmdbuf_pool = NULL;
 }
 
 void cmdbuf_begin(vkcmdbuffer_t *cmdbuffer, int single, int rpass_cont, int sim_use) {
@@ -175,7 +189,7 @@ vkrendpass_t* create_vkrendpass(vkdev_t *dev, vkswapchain_t *swapchain, vec4 are
         dep.dstAccessMask = 0;
         dep.dependencyFlags = 0;
 
-        vkrendpass_t *ret = rune_alloc(sizeof(vkrendpass_t));
+        vkrendpass_t *ret = rune_alloc_tagged(sizeof(vkrendpass_t), MEM_TAG_RENDER);
         ret->color[0] = color[0];
         ret->color[1] = color[1];
         ret->color[2] = color[2];
@@ -34,6 +34,7 @@ enum cmdbuf_state {
 
 vkcmdbuffer_t* create_vkcmdbuffer(vkdev_t *dev, int primary);
 void destroy_vkcmdbuffer(vkcmdbuffer_t *cmdbuffer, vkdev_t *dev);
+void destroy_vkcmdbuffer_pool(void);
 
 void cmdbuf_begin(vkcmdbuffer_t *cmdbuffer, int single, int rpass_cont, int sim_use);
 void cmdbuf_end(vkcmdbuffer_t *cmdbuffer);
@@ -28,7 +28,7 @@
 #include <rune/util/stubbed.h>
 
 vkswapchain_t* create_swapchain(vksurface_t *surface, vkdev_t *dev) {
-        vkswapchain_t *swapchain = rune_alloc(sizeof(vkswapchain_t));
+        vkswapchain_t *swapchain = rune_alloc_tagged(sizeof(vkswapchain_t), MEM_TAG_RENDER);
         VkExtent2D sc_extent = {surface->width, surface->height};
         swapchain->max_frames = 2;
         get_swapchain_data(dev, &surface->handle);
@@ -74,8 +74,8 @@ vkswapchain_t* create_swapchain(vksurface_t *surface, vkdev_t *dev) {
         vkassert(vkCreateSwapchainKHR(dev->ldev, &cinfo, NULL, &swapchain->handle));
         vkassert(vkGetSwapchainImagesKHR(dev->ldev, swapchain->handle, &swapchain->img_count, NULL));
 
-        swapchain->images = rune_alloc(sizeof(VkImage) * swapchain->img_count);
-        swapchain->views = rune_alloc(sizeof(VkImageView) * swapchain->img_count);
+        swapchain->images = rune_alloc_tagged(sizeof(VkImage) * swapchain->img_count, MEM_TAG_RENDER);
+        swapchain->views = rune_alloc_tagged(sizeof(VkImageView) * swapchain->img_count, MEM_TAG_RENDER);
         vkassert(vkGetSwapchainImagesKHR(dev->ldev, swapchain->handle, &swapchain->img_count, swapchain->images));
 
         VkImageViewCreateInfo vcinfo;
@@ -24,17 +24,108 @@
 
 #include <rune/util/types.h>
 #include <rune/util/list.h>
+#include <stdatomic.h>
+
+/**
+ * Subsystems that allocations are charged to, further tags can be added at
+ * runtime with rune_mem_register_tag
+ */
+enum mem_tag {
+        MEM_TAG_GENERAL,        ///< Untagged allocations
+        MEM_TAG_RENDER,         ///< Renderer and graphics backends
+        MEM_TAG_MOD,            ///< Mod loader and mod data
+        MEM_TAG_AUDIO,          ///< Audio system
+        MEM_TAG_THREAD,         ///< Threading layer
+        MEM_TAG_UI,             ///< Windowing and input
+        MEM_TAG_LOG,            ///< Logging
+        MEM_TAG_FRAME,          ///< Frame arena overflow
+        MEM_TAG_USER,           ///< First tag handed out by rune_mem_register_tag
+        MEM_TAG_MAX = 64        ///< Maximum number of tags
+};
+
+/**
+ * Snapshot of the memory charged to a single tag
+ */
+typedef struct mem_stats {
+        const char *name;       ///< Name of the tag
+        size_t current;         ///< Bytes currently allocated
+        size_t peak;            ///< Highest value current has reached
+        size_t count;           ///< Number of live allocations
+        size_t total;           ///< Number of allocations made since startup
+        size_t budget;          ///< Budget in bytes, 0 if none is set
+} mem_stats_t;
+
+/**
+ * Page sizes the allocator may use for its arenas
+ */
+enum alloc_hugepages {
+        ALLOC_HUGEPAGES_OFF,            ///< Normal pages only
+        ALLOC_HUGEPAGES_TRANSPARENT,    ///< Ask the kernel to back arenas with transparent huge pages
+        ALLOC_HUGEPAGES_EXPLICIT        ///< Reserve arenas from the huge page pool, falling back to transparent huge pages
+};
+
+#define ALLOC_TRACE_MAGIC       0x52545241      ///< "ARTR" in little endian
+#define ALLOC_TRACE_VERSION     1
+
+/**
+ * Operations recorded in an allocation trace
+ */
+enum alloc_trace_op {
+        ALLOC_TRACE_ALLOC,      ///< rune_alloc and its variants
+        ALLOC_TRACE_REALLOC,    ///< rune_realloc
+        ALLOC_TRACE_FREE        ///< rune_free
+};
+
+/**
+ * Header at the start of an allocation trace file
+ */
+typedef struct alloc_trace_header {
+        uint32_t magic;         ///< Always ALLOC_TRACE_MAGIC
+        uint32_t version;       ///< Always ALLOC_TRACE_VERSION
+        uint32_t record_size;   ///< Size of alloc_trace_record_t
+        uint32_t reserved;      ///< Always 0
+} alloc_trace_header_t;
+
+/**
+ * A single allocator call in an allocation trace
+ */
+typedef struct alloc_trace_record {
+        uint64_t timestamp;     ///< Nanoseconds since the trace was started
+        uint64_t ptr;           ///< Returned pointer, or the pointer being freed
+        uint64_t old_ptr;       ///< Pointer passed to rune_realloc, 0 otherwise
+        uint64_t size;          ///< Requested size, 0 for frees
+        uint32_t thread;        ///< Sequential ID of the calling thread
+        uint8_t op;             ///< One of enum alloc_trace_op
+        uint8_t tag;            ///< Tag the memory is charged to, 0 for reallocs and frees
+        uint8_t align_shift;    ///< Log2 of the requested alignment
+        uint8_t reserved;       ///< Always 0
+} alloc_trace_record_t;
 
 /**
  * Memory block used for memory accounting
  */
 typedef struct mem_block {
-        void *ptr;
-        size_t sz;
-        int free;
-        list_head_t list;
+        void *ptr;                      ///< Start of the usable memory
+        size_t sz;                      ///< Usable size of the block
+        uint16_t free;                  ///< 1 if the block is free, 0 otherwise
+        uint16_t tag;                   ///< Tag the block is charged to
+        uint32_t align;                 ///< Alignment the block was requested with
+        struct mem_block *prev_phys;    ///< Physically preceding block, used for coalescing
+        list_head_t list;               ///< Free list or block list membership, used internally
 } mem_block_t;
 
+/**
+ * Fixed-size object pool, elements are stored contiguously in chunks
+ */
+typedef struct mem_pool {
+        size_t elem_size;       ///< Size of a single element, rounded up for alignment
+        size_t count;           ///< Number of elements added each time the pool grows
+        int tag;                ///< Tag the pool's chunks are charged to
+        void *free_list;        ///< Intrusive list of free elements, used internally
+        void *chunks;           ///< List of backing chunks, used internally
+        atomic_flag lock;       ///< Protects the free list, used internally
+} mem_pool_t;
+
 /**
  * \brief Custom malloc implementation
  * \param[in] sz The size of the requested memory block
@@ -42,6 +133,33 @@ typedef struct mem_block {
  */
 RAPI void* rune_alloc(size_t sz);
 
+/**
+ * \brief Allocates memory charged to a tag
+ * \param[in] sz The size of the requested memory block
+ * \param[in] tag One of enum mem_tag, or a tag returned by rune_mem_register_tag
+ * \return A pointer to void, or NULL in case of error
+ */
+RAPI void* rune_alloc_tagged(size_t sz, int tag);
+
+/**
+ * \brief Allocates a block whose address is a multiple of align
+ * The block is released with rune_free. rune_realloc does not preserve
+ * alignments stricter than the default.
+ * \param[in] sz The size of the requested memory block
+ * \param[in] align Required alignment, a power of two no larger than 64K
+ * \return A pointer to void, or NULL in case of error
+ */
+RAPI void* rune_alloc_aligned(size_t sz, size_t align);
+
+/**
+ * \brief Allocates an aligned block charged to a tag
+ * \param[in] sz The size of the requested memory block
+ * \param[in] align Required alignment, a power of two no larger than 64K
+ * \param[in] tag Tag to charge the block to
+ * \return A pointer to void, or NULL in case of error
+ */
+RAPI void* rune_alloc_aligned_tagged(size_t sz, size_t align, int tag);
+
 /**
  * \brief Custom calloc implementation
  * \param[in] nmemb An integer to fill the memory block with
@@ -50,8 +168,18 @@ RAPI void* rune_alloc(size_t sz);
  */
 RAPI void* rune_calloc(size_t nmemb, size_t sz);
 
+/**
+ * \brief Allocates zeroed memory charged to a tag
+ * \param[in] nmemb An integer to fill the memory block with
+ * \param[in] sz The size of the requested memory block
+ * \param[in] tag Tag to charge the block to
+ * \return A pointer to void, or NULL in case of error
+ */
+RAPI void* rune_calloc_tagged(size_t nmemb, size_t sz, int tag);
+
 /**
  * \brief Custom realloc implementation
+ * The block stays charged to the tag it was allocated with.
  * \param[in] ptr A void pointer to a previously alloc'd block, or NULL
  * \param[in] sz The size of the requested memory block
  * \return A pointer to void, or NULL in case of error
@@ -71,4 +199,179 @@ RAPI void rune_free(void *ptr);
  */
 RAPI void rune_free_all(void);
 
+/**
+ * \brief Measures external fragmentation of the large block heap
+ * \return 0 when all free heap memory is one contiguous block, approaching 1 as
+ * free memory is scattered across smaller blocks
+ */
+RAPI float rune_alloc_fragmentation(void);
+
+/**
+ * \brief Selects the page size used for arenas reserved from now on
+ * Arenas that are already reserved keep their pages, so this should be set
+ * from the engine configuration before anything is allocated. When huge pages
+ * are unavailable the allocator logs a warning and uses normal pages.
+ * \param[in] mode One of enum alloc_hugepages, ALLOC_HUGEPAGES_OFF by default
+ */
+RAPI void rune_alloc_set_hugepages(int mode);
+
+/**
+ * \brief Measures how much of the allocator's resident memory is on huge pages
+ * Only supported on Linux, where it reads /proc/self/smaps.
+ * \param[out] resident Bytes of allocator memory currently resident
+ * \param[out] huge Bytes of that memory backed by huge pages
+ * \return 0, or -1 if the information is unavailable
+ */
+RAPI int rune_alloc_hugepage_coverage(size_t *resident, size_t *huge);
+
+/**
+ * \brief Starts recording every allocator call to a binary trace file
+ * The file starts with an alloc_trace_header_t followed by one
+ * alloc_trace_record_t per call. Recording slows the allocator down and
+ * should only be enabled to capture workloads for rune-alloc-replay.
+ * \param[in] path File to write the trace to, replaced if it exists
+ * \return 0, or -1 on error
+ */
+RAPI int rune_alloc_trace_start(const char *path);
+
+/**
+ * \brief Stops recording and closes the trace file, called by rune_free_all
+ */
+RAPI void rune_alloc_trace_stop(void);
+
+/**
+ * \brief Adds a named tag for a subsystem not covered by enum mem_tag
+ * \param[in] name Name shown in statistics, must stay valid for the lifetime
+ * of the engine
+ * \return The new tag, or -1 if all tags are in use
+ */
+RAPI int rune_mem_register_tag(const char *name);
+
+/**
+ * \brief Returns the number of tags currently defined
+ */
+RAPI int rune_mem_num_tags(void);
+
+/**
+ * \brief Reads the statistics of a tag
+ * Counters are updated without locking, so a snapshot taken while other
+ * threads allocate may be slightly out of date.
+ * \param[in] tag Tag to query
+ * \param[out] stats Filled in with the tag's statistics
+ * \return 0, or -1 if the tag does not exist
+ */
+RAPI int rune_mem_get_stats(int tag, mem_stats_t *stats);
+
+/**
+ * \brief Sets a budget for a tag, a warning is logged when it is exceeded
+ * \param[in] tag Tag to set the budget for
+ * \param[in] budget Budget in bytes, or 0 to remove it
+ */
+RAPI void rune_mem_set_budget(int tag, size_t budget);
+
+/**
+ * \brief Sets how often rune_mem_tick dumps statistics to the log
+ * \param[in] seconds Interval between dumps, or 0 to disable periodic dumps
+ */
+RAPI void rune_mem_set_dump_interval(uint32_t seconds);
+
+/**
+ * \brief Writes the statistics of every tag in use and the huge page coverage
+ * to the log
+ */
+RAPI void rune_mem_dump_stats(void);
+
+/**
+ * \brief Checks budgets and performs periodic dumps, called once per frame
+ */
+RAPI void rune_mem_tick(void);
+
+/**
+ * \brief Creates a pool of fixed-size elements
+ * \param[in] elem_size Size of each element
+ * \param[in] count Number of elements to reserve up front, the pool grows by
+ * the same amount when exhausted
+ * \return A pointer to the new pool, or NULL in case of error
+ */
+RAPI mem_pool_t* rune_pool_create(size_t elem_size, size_t count);
+
+/**
+ * \brief Creates a pool whose memory is charged to a tag
+ * \param[in] elem_size Size of each element
+ * \param[in] count Number of elements to reserve up front
+ * \param[in] tag Tag to charge the pool to
+ * \return A pointer to the new pool, or NULL in case of error
+ */
+RAPI mem_pool_t* rune_pool_create_tagged(size_t elem_size, size_t count, int tag);
+
+/**
+ * \brief Releases a pool and every element in it
+ * \param[in] pool Pool created by rune_pool_create
+ */
+RAPI void rune_pool_destroy(mem_pool_t *pool);
+
+/**
+ * \brief Takes an element from a pool
+ * \param[in] pool Pool created by rune_pool_create
+ * \return A pointer to an uninitialized element, or NULL in case of error
+ */
+RAPI void* rune_pool_alloc(mem_pool_t *pool);
+
+/**
+ * \brief Returns an element to its pool
+ * \param[in] pool Pool the element was taken from
+ * \param[in] ptr Element returned by rune_pool_alloc, or NULL
+ */
+RAPI void rune_pool_free(mem_pool_t *pool, void *ptr);
+
+/**
+ * \brief Sets up one linear arena per frame in flight for transient allocations
+ * \param[in] frames Number of frames in flight, usually the swapchain's max_frames
+ * \param[in] sz Size of each arena in bytes
+ * \return 0, or -1 on error
+ */
+RAPI int rune_frame_alloc_init(uint8_t frames, size_t sz);
+
+/**
+ * \brief Releases all frame arenas, called by rune_free_all
+ */
+RAPI void rune_frame_alloc_close(void);
+
+/**
+ * \brief Resets the arena belonging to a frame in flight and makes it current
+ * This must only be called once the previous contents of the frame are no
+ * longer in use, e.g. after waiting on the frame's in-flight fence. With the
+ * render pipeline it is called by rune_render_acquire_packet on the thread
+ * producing packets, never by the render thread, and a threaded pipeline
+ * needs at least two frames in flight so the packet being drawn keeps its
+ * arena.
+ * \param[in] frame Index of the frame in flight
+ */
+RAPI void rune_frame_begin(uint32_t frame);
+
+/**
+ * \brief Allocates memory that lives until the same frame comes around again
+ * The returned memory must not be freed; it is released in bulk by the next
+ * rune_frame_begin for the same frame. Safe to call from any thread.
+ * \param[in] sz The size of the requested memory block
+ * \return A pointer to void, or NULL in case of error
+ */
+RAPI void* rune_frame_alloc(size_t sz);
+
+/**
+ * \brief Gets the number of frame arenas set up by rune_frame_alloc_init
+ * \return Number of frames in flight, 0 if frame arenas are not set up
+ */
+RAPI uint8_t rune_frame_count(void);
+
+/**
+ * \brief Allocates from the arena of a given frame rather than the current one
+ * Lets the render thread allocate for the packet it is drawing while the
+ * next frame is already being simulated. Safe to call from any thread.
+ * \param[in] frame Frame number, e.g. render_packet_t::frame
+ * \param[in] sz The size of the requested memory block
+ * \return A pointer to void, or NULL in case of error
+ */
+RAPI void* rune_frame_alloc_for(uint64_t frame, size_t sz);
+
 #endif
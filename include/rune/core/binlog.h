@@ -0,0 +1,126 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef RUNE_CORE_BINLOG_H
+#define RUNE_CORE_BINLOG_H
+
+#include <rune/core/logging.h>
+#include <rune/util/types.h>
+#include <stdatomic.h>
+
+#define BINLOG_MAGIC            0x474f4c52      ///< "RLOG" in little endian
+#define BINLOG_VERSION          1
+#define BINLOG_FORMAT_ID        0               ///< Record ID of a format string definition
+#define BINLOG_INVALID_ID       UINT32_MAX      ///< Returned for format strings that cannot be logged
+#define BINLOG_MAX_STRING       256             ///< Longest %s argument stored, longer strings are truncated
+
+/**
+ * Header at the start of a binary log file
+ */
+typedef struct binlog_header {
+        uint32_t magic;         ///< Always BINLOG_MAGIC
+        uint32_t version;       ///< Always BINLOG_VERSION
+        uint32_t record_size;   ///< Size of binlog_record_t
+        uint32_t reserved;      ///< Always 0
+} binlog_header_t;
+
+/**
+ * Fixed part of every record in a binary log file
+ *
+ * A record with id BINLOG_FORMAT_ID defines a format string. It is
+ * followed by a uint16_t format ID, a uint16_t log level and the
+ * NUL-terminated format string. Every other record is a message, followed
+ * by its arguments in order: 8 bytes for each integer, pointer or double,
+ * and a uint16_t length plus the bytes for each string.
+ */
+typedef struct binlog_record {
+        uint64_t timestamp;     ///< Nanoseconds since the log was started
+        uint16_t size;          ///< Size of the record including this header
+        uint16_t id;            ///< Format ID, or BINLOG_FORMAT_ID
+        uint16_t thread;        ///< Sequential ID of the logging thread
+        uint16_t reserved;      ///< Always 0
+} binlog_record_t;
+
+/**
+ * \brief Log a message to the binary log
+ *
+ * The format string is registered on the first call from each call site,
+ * after that a message costs a timestamp and a copy of its arguments.
+ * Formatting happens offline with rune-logdecode. Arguments are not
+ * evaluated while the binary log is stopped.
+ */
+#define RBLOG(level, fmt, ...)                                                                  \
+        do {                                                                                    \
+                static _Atomic uint32_t _rune_binlog_id = 0;                                    \
+                if ((level) <= RUNE_MIN_LOG_LEVEL && rune_binlog_active()) {                    \
+                        uint32_t _id = atomic_load_explicit(&_rune_binlog_id, memory_order_relaxed); \
+                        if (_id == 0) {                                                         \
+                                _id = rune_binlog_register((level), (fmt));                     \
+                                atomic_store_explicit(&_rune_binlog_id, _id, memory_order_relaxed); \
+                        }                                                                       \
+                        rune_binlog_write(_id __VA_OPT__(,) __VA_ARGS__);                       \
+                }                                                                               \
+        } while (0)
+
+/**
+ * \brief Starts writing binary log records to a file
+ * \param[in] path File to write the log to, replaced if it exists
+ * \return 0 on success, -1 on error
+ */
+RAPI int rune_binlog_start(const char *path);
+
+/**
+ * \brief Writes out every thread's pending records and closes the file
+ */
+RAPI void rune_binlog_stop(void);
+
+/**
+ * \brief Writes out every thread's pending records
+ */
+RAPI void rune_binlog_flush(void);
+
+/**
+ * \brief Checks whether the binary log is recording
+ * \return 1 if rune_binlog_start has been called, 0 otherwise
+ */
+RAPI int rune_binlog_active(void);
+
+/**
+ * \brief Registers a format string, used by RBLOG
+ *
+ * Registering the same string again returns the same ID. Supports the
+ * integer, floating point, %p, %c and %s conversions with any flags, width,
+ * precision and length modifier except L, plus * widths.
+ *
+ * \param[in] level Error level, a value in log_level
+ * \param[in] fmt Format string, must stay valid for the life of the program
+ * \return Format ID, or BINLOG_INVALID_ID if fmt is unsupported or the table is full
+ */
+RAPI uint32_t rune_binlog_register(int level, const char *fmt);
+
+/**
+ * \brief Appends a message to the calling thread's binary log buffer, used by RBLOG
+ * \param[in] id Format ID returned by rune_binlog_register
+ * \param[in] ... Arguments matching the format string
+ */
+RAPI void rune_binlog_write(uint32_t id, ...);
+
+#endif
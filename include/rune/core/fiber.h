@@ -0,0 +1,70 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef RUNE_CORE_FIBER_H
+#define RUNE_CORE_FIBER_H
+
+#include <rune/util/types.h>
+#include <rune/core/thread.h>
+
+/// Usable stack size of every fiber, in bytes
+#define FIBER_STACK_SIZE (64 * 1024)
+
+/**
+ * Function executed by a fiber
+ */
+typedef void (*fiber_fn_t)(void *data);
+
+/**
+ * \brief Starts a fiber on the job system
+ * A fiber runs like a job, but has its own stack, so it can suspend in
+ * rune_fiber_yield or rune_fiber_wait without holding up the worker
+ * thread. It may resume on a different worker, so fiber code must not keep
+ * pointers to thread-local data across a suspension.
+ * \param[in] fn Function to execute
+ * \param[in] data Argument passed to fn
+ * \param[in] counter Incremented now and decremented when fn returns, or
+ * NULL
+ * \return 0, or -1 if no stack could be allocated
+ */
+RAPI int rune_fiber_run(fiber_fn_t fn, void *data, job_counter_t *counter);
+
+/**
+ * \brief Suspends the calling fiber and queues it to resume later
+ * Outside a fiber this only yields the CPU to other threads.
+ */
+RAPI void rune_fiber_yield(void);
+
+/**
+ * \brief Suspends the calling fiber until a counter drops to zero
+ * The worker runs other jobs in the meantime. Outside a fiber this behaves
+ * like rune_job_wait.
+ * \param[in] counter Counter passed to rune_job_run or rune_fiber_run
+ */
+RAPI void rune_fiber_wait(job_counter_t *counter);
+
+/**
+ * \brief Checks whether the caller is running inside a fiber
+ * \return 1 inside a fiber, 0 otherwise
+ */
+RAPI int rune_fiber_active(void);
+
+#endif
@@ -23,6 +23,7 @@
 #define RUNE_CORE_LOGGING_H
 
 #include <rune/util/types.h>
+#include <stdatomic.h>
 
 /// Indicates the error level of the message
 enum log_level {
@@ -33,6 +34,106 @@ enum log_level {
         LOG_DEBUG       ///< A confirmation or other debugging message, only printed when enabled
 };
 
+/**
+ * Least severe level compiled into the build. RLOG_* calls above it are
+ * removed by the compiler, and log_output discards them at runtime.
+ */
+#ifndef RUNE_MIN_LOG_LEVEL
+#define RUNE_MIN_LOG_LEVEL LOG_DEBUG
+#endif
+
+/**
+ * \brief Log a message only if its level is enabled
+ *
+ * The level is checked before the arguments are evaluated, so a disabled
+ * message costs a compare and never reaches vsnprintf.
+ */
+#define RLOG(level, ...)                                                        \
+        do {                                                                    \
+                if ((level) <= RUNE_MIN_LOG_LEVEL && rune_log_enabled(level))   \
+                        log_output((level), __VA_ARGS__);                       \
+        } while (0)
+
+#define RLOG_FATAL(...) RLOG(LOG_FATAL, __VA_ARGS__)   ///< RLOG at LOG_FATAL
+#define RLOG_ERROR(...) RLOG(LOG_ERROR, __VA_ARGS__)   ///< RLOG at LOG_ERROR
+#define RLOG_WARN(...)  RLOG(LOG_WARN, __VA_ARGS__)    ///< RLOG at LOG_WARN
+#define RLOG_INFO(...)  RLOG(LOG_INFO, __VA_ARGS__)    ///< RLOG at LOG_INFO
+#define RLOG_DEBUG(...) RLOG(LOG_DEBUG, __VA_ARGS__)   ///< RLOG at LOG_DEBUG
+
+#define LOG_RATELIMIT_BURST     5       ///< Messages RLOG_LIMITED lets through per interval
+#define LOG_RATELIMIT_INTERVAL  5000    ///< Length of the RLOG_LIMITED interval in milliseconds
+
+/**
+ * Rate limit state for one call site, zero-initialized before first use
+ *
+ * RLOG_RATELIMIT declares one of these as a static at each call site. Code
+ * that limits several kinds of message from one place, such as a callback,
+ * keeps one per kind.
+ */
+typedef struct log_ratelimit {
+        _Atomic int64_t start;          ///< Start of the current interval in nanoseconds, 0 before first use
+        atomic_int count;               ///< Messages let through in the current interval
+        atomic_int suppressed;          ///< Messages dropped since the last summary
+        int pending;                    ///< Set while on the list of sites with unreported drops
+        int level;                      ///< Level of the suppression summary
+        int interval;                   ///< Interval length in milliseconds
+        const char *file;               ///< Source file reported in the summary
+        int line;                       ///< Source line reported in the summary
+        struct log_ratelimit *next;     ///< Next site with unreported drops
+} log_ratelimit_t;
+
+/**
+ * \brief Log a message at most burst times every interval milliseconds
+ *
+ * Messages are counted per call site. Once the burst is used up further
+ * messages are dropped, and the number dropped is logged when the interval
+ * has passed, either with the next message from the site or by the log
+ * writer, and on rune_log_flush.
+ */
+#define RLOG_RATELIMIT(level, burst, interval, fmt, ...)                                        \
+        do {                                                                                    \
+                static log_ratelimit_t _rune_ratelimit;                                         \
+                if ((level) <= RUNE_MIN_LOG_LEVEL && rune_log_enabled(level)                    \
+                                && rune_log_ratelimit(&_rune_ratelimit, (level), __FILE__, __LINE__, (burst), (interval))) \
+                        log_output((level), (fmt) __VA_OPT__(,) __VA_ARGS__);                   \
+        } while (0)
+
+/// RLOG_RATELIMIT with LOG_RATELIMIT_BURST and LOG_RATELIMIT_INTERVAL
+#define RLOG_LIMITED(level, fmt, ...) \
+        RLOG_RATELIMIT(level, LOG_RATELIMIT_BURST, LOG_RATELIMIT_INTERVAL, fmt __VA_OPT__(,) __VA_ARGS__)
+
+/**
+ * Destination for formatted log lines
+ *
+ * Sinks are called with the sink lock held, one line at a time, and must
+ * not log themselves.
+ */
+typedef struct log_sink {
+        void (*write)(struct log_sink *sink, int level, const char *line, size_t len); ///< Writes one line, including its newline
+        void (*flush)(struct log_sink *sink);   ///< Pushes buffered lines out, may be NULL
+        void (*close)(struct log_sink *sink);   ///< Releases the sink once it is removed, may be NULL
+        void *data;                             ///< Sink specific state
+} log_sink_t;
+
+/**
+ * \brief Check whether messages at a given level will be printed
+ * \param[in] level Error level, a value in log_level
+ * \return 1 if the level is enabled, 0 otherwise
+ */
+RAPI int rune_log_enabled(int level);
+
+/**
+ * \brief Decide whether a repeated message should be logged, used by RLOG_RATELIMIT
+ * \param[in] limit Rate limit state of the call site, must stay valid while logging runs
+ * \param[in] level Error level used for the suppression summary
+ * \param[in] file Source file reported in the summary
+ * \param[in] line Source line reported in the summary
+ * \param[in] burst Messages allowed per interval
+ * \param[in] interval Length of the interval in milliseconds
+ * \return 1 if the message should be logged, 0 if it is suppressed
+ */
+RAPI int rune_log_ratelimit(log_ratelimit_t *limit, int level, const char *file, int line, int burst, int interval);
+
 /**
  * \brief Print message to the engine log
  * \param[in] level Error level, a value in log_level
@@ -41,6 +142,70 @@ enum log_level {
  */
 RAPI void log_output(int level, const char *fmt, ...);
 
+/**
+ * \brief Move log output onto a background writer thread
+ *
+ * Messages are queued on a per-thread ring and written by the writer. If a
+ * ring fills up, new messages from that thread are dropped and the number
+ * lost is reported. Fatal messages are always written synchronously after
+ * a flush. rune_init only calls this when the log_async setting is on,
+ * otherwise messages are written synchronously and never dropped.
+ *
+ * \return 0 on success, -1 if the writer thread could not be started
+ */
+RAPI int rune_log_start_async(void);
+
+/**
+ * \brief Flush pending messages and return to synchronous logging
+ */
+RAPI void rune_log_stop_async(void);
+
+/**
+ * \brief Block until all queued messages have been written
+ */
+RAPI void rune_log_flush(void);
+
+/**
+ * \brief Get the sink that prints to stdout, installed by default
+ * \return Pointer to the stdout sink, which can be passed to rune_log_remove_sink
+ */
+RAPI log_sink_t* rune_log_stdout_sink(void);
+
+/**
+ * \brief Send every log line to a sink as well
+ * \param[in] sink Sink to add, owned by the logger until it is removed
+ * \return 0 on success, -1 if too many sinks are installed
+ */
+RAPI int rune_log_add_sink(log_sink_t *sink);
+
+/**
+ * \brief Flush and close a sink and stop sending lines to it
+ * \param[in] sink Sink to remove
+ */
+RAPI void rune_log_remove_sink(log_sink_t *sink);
+
+/**
+ * \brief Close every sink and go back to printing to stdout, called by rune_exit
+ */
+RAPI void rune_log_close_sinks(void);
+
+/**
+ * \brief Create a sink that appends to a file through a memory-mapped window
+ *
+ * Lines are prefixed with the local time. The file is rotated when the
+ * next line would take it past max_size, or when it has been open for
+ * max_age seconds. Rotated files are renamed to path.1, path.2 and so on,
+ * and only max_files of them are kept. A limit of 0 turns that check off,
+ * and a max_files of 0 keeps every rotated file.
+ *
+ * \param[in] path File to append to, created if it does not exist
+ * \param[in] max_size Size in bytes at which to rotate
+ * \param[in] max_age Age in seconds at which to rotate
+ * \param[in] max_files Number of rotated files to keep
+ * \return New sink to pass to rune_log_add_sink, or NULL on error
+ */
+RAPI log_sink_t* rune_log_file_sink(const char *path, size_t max_size, int max_age, int max_files);
+
 /**
  * \brief Enable debug logging
  */
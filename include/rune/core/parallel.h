@@ -0,0 +1,97 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef RUNE_CORE_PARALLEL_H
+#define RUNE_CORE_PARALLEL_H
+
+#include <rune/util/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Loop body processing items [begin, end)
+ */
+typedef void (*parallel_for_fn_t)(size_t begin, size_t end, void *ctx);
+
+/**
+ * Reduction body folding items [begin, end) into partial, which starts out
+ * as a copy of the identity value
+ */
+typedef void (*parallel_reduce_fn_t)(size_t begin, size_t end, void *partial, void *ctx);
+
+/**
+ * Folds the partial result src into dst
+ */
+typedef void (*parallel_combine_fn_t)(void *dst, const void *src, void *ctx);
+
+/**
+ * \brief Runs a loop body over a range, split into chunks across the job
+ * system
+ * Returns once every item has been processed. The calling thread helps
+ * run chunks while it waits.
+ * \param[in] begin First item
+ * \param[in] end One past the last item
+ * \param[in] grain Items per chunk, or 0 to size chunks automatically from
+ * the per-item cost measured on earlier calls with the same fn
+ * \param[in] fn Loop body, called concurrently on disjoint ranges
+ * \param[in] ctx Argument passed to fn
+ */
+RAPI void rune_parallel_for(size_t begin, size_t end, size_t grain, parallel_for_fn_t fn, void *ctx);
+
+/**
+ * \brief Reduces a range in parallel
+ * Partial results are combined in range order, so the result is the same on
+ * every run for a given grain even if combine is not commutative.
+ * \param[in] begin First item
+ * \param[in] end One past the last item
+ * \param[in] grain Items per chunk, or 0 to size chunks automatically
+ * \param[in,out] result Holds the identity value on entry, and the reduced
+ * value on return
+ * \param[in] result_size Size of the result in bytes
+ * \param[in] fn Reduction body
+ * \param[in] combine Combines two partial results
+ * \param[in] ctx Argument passed to fn and combine
+ * \return 0, or -1 if memory for partial results cannot be allocated
+ */
+RAPI int rune_parallel_reduce(size_t begin, size_t end, size_t grain, void *result, size_t result_size, parallel_reduce_fn_t fn, parallel_combine_fn_t combine, void *ctx);
+
+/**
+ * \brief Sorts keys in ascending order with a parallel LSD radix sort
+ * The sort is stable. Passes over byte positions where every key holds
+ * the same value are skipped.
+ * \param[in,out] keys Keys to sort
+ * \param[in,out] values Payload permuted along with the keys, or NULL
+ * \param[in] count Number of keys
+ * \param[in] key_bits Number of low-order key bits to sort by, up to 64
+ * \return 0, or -1 if scratch memory cannot be allocated
+ */
+RAPI int rune_parallel_radix_sort(uint64_t *keys, uint32_t *values, size_t count, int key_bits);
+
+/**
+ * \brief Computes an exclusive prefix sum in parallel
+ * \param[in] in Input values
+ * \param[out] out Receives the sum of all preceding inputs, may equal in
+ * \param[in] count Number of values
+ * \return Sum of all inputs
+ */
+RAPI uint64_t rune_parallel_prefix_sum(const uint64_t *in, uint64_t *out, size_t count);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef RUNE_CORE_TASKGRAPH_H
+#define RUNE_CORE_TASKGRAPH_H
+
+#include <rune/util/types.h>
+#include <stdint.h>
+
+/// Maximum number of stages in one task graph
+#define TASKGRAPH_MAX_STAGES    64
+
+/// Maximum number of named resources in one task graph
+#define TASKGRAPH_MAX_RESOURCES 64
+
+/**
+ * Opaque task graph handle, created by rune_taskgraph_new
+ */
+typedef struct task_graph task_graph_t;
+
+/**
+ * Function executed once per run of a stage
+ */
+typedef void (*task_stage_fn_t)(void *data);
+
+/**
+ * \brief Creates an empty task graph
+ * \return Handle to the new graph, or NULL on error
+ */
+RAPI task_graph_t* rune_taskgraph_new(void);
+
+/**
+ * \brief Destroys a task graph, which must not be running
+ * \param[in] graph Graph created by rune_taskgraph_new, or NULL
+ */
+RAPI void rune_taskgraph_free(task_graph_t *graph);
+
+/**
+ * \brief Gets the bit for a named resource, registering it if needed
+ * Resources describe the data stages touch, e.g. "input", "world" or
+ * "cmdbuffers". Combine the returned bits to build read and write sets.
+ * \param[in] graph Graph the resource belongs to
+ * \param[in] name Resource name, the same name always maps to the same bit
+ * \return Single-bit mask, or 0 if the graph already has the maximum number
+ * of resources
+ */
+RAPI uint64_t rune_taskgraph_resource(task_graph_t *graph, const char *name);
+
+/**
+ * \brief Registers a stage
+ * A stage runs after every earlier-registered stage whose accesses conflict
+ * with its own, i.e. when either one writes a resource the other reads or
+ * writes. Stages without conflicts may run in parallel.
+ * \param[in] graph Graph to add to
+ * \param[in] name Stage name used in reports, truncated to 31 characters
+ * \param[in] fn Function executed by the stage
+ * \param[in] data Argument passed to fn
+ * \param[in] reads Mask of resources the stage reads
+ * \param[in] writes Mask of resources the stage writes
+ * \return Index of the new stage, or -1 if the graph is full
+ */
+RAPI int rune_taskgraph_add_stage(task_graph_t *graph, const char *name, task_stage_fn_t fn, void *data, uint64_t reads, uint64_t writes);
+
+/**
+ * \brief Adds an explicit ordering between two stages
+ * Only needed for orderings not implied by resource access.
+ * \param[in] graph Graph both stages belong to
+ * \param[in] before Stage that must finish first
+ * \param[in] after Stage that must wait for before
+ * \return 0, or -1 if either index is invalid
+ */
+RAPI int rune_taskgraph_add_dependency(task_graph_t *graph, int before, int after);
+
+/**
+ * \brief Builds the dependency DAG
+ * Called automatically by the first rune_taskgraph_run after stages or
+ * dependencies change. Redundant edges implied by other paths are removed.
+ * \param[in] graph Graph to build
+ * \return 0, or -1 if the explicit dependencies form a cycle
+ */
+RAPI int rune_taskgraph_build(task_graph_t *graph);
+
+/**
+ * \brief Runs every stage once on the job system and waits for them
+ * \param[in] graph Graph to run
+ * \return 0, or -1 if the graph cannot be built
+ */
+RAPI int rune_taskgraph_run(task_graph_t *graph);
+
+/**
+ * \brief Gets the critical path, the longest chain of dependent stages
+ * Stage durations are smoothed over recent runs.
+ * \param[in] graph Graph that has been run at least once
+ * \param[out] stages Receives stage indices in execution order, may be NULL
+ * \param[in] max Capacity of stages
+ * \param[out] length_ns Receives the length of the path in nanoseconds, may
+ * be NULL
+ * \return Number of stages on the path
+ */
+RAPI int rune_taskgraph_critical_path(task_graph_t *graph, int *stages, int max, int64_t *length_ns);
+
+/**
+ * \brief Gets the name of a stage
+ * \param[in] graph Graph the stage belongs to
+ * \param[in] stage Stage index
+ * \return Stage name, or NULL if the index is invalid
+ */
+RAPI const char* rune_taskgraph_stage_name(task_graph_t *graph, int stage);
+
+/**
+ * \brief Logs the critical path every few runs
+ * \param[in] graph Graph to report on
+ * \param[in] frames Runs between reports, or 0 to disable reporting
+ */
+RAPI void rune_taskgraph_set_report_interval(task_graph_t *graph, int frames);
+
+#endif
@@ -24,6 +24,7 @@
 
 #include <rune/util/types.h>
 #include <rune/util/list.h>
+#include <stdatomic.h>
 
 /**
  * Platform-agnostic thread handle
@@ -32,17 +33,93 @@ typedef struct thread {
         int ID;                 ///< In-engine thread ID
         int detached;           ///< 1 if thread has been detached, 0 otherwise
         void *thread_handle;    ///< System-defined thread handle, usually a pthread_t
+        atomic_int os_id;       ///< Kernel thread ID where the platform has one, 0 until the thread starts
         struct list_head list;  ///< Linked list of all threads, used internally
 } thread_t;
 
 /**
- * Platform-agnostic mutex handle
+ * Scheduling priority classes for rune_thread_set_priority
  */
-typedef struct mutex {
-        int ID;                 ///< In-engine mutex ID
-        void *mutex_handle;     ///< System-defined mutex handle, usually a pthread_mutex_t
-        struct list_head list;  ///< Linked list of all mutexes, used internally
-} mutex_t;
+enum thread_priority {
+        THREAD_PRIORITY_LOW,            ///< Only runs when the CPU would otherwise idle
+        THREAD_PRIORITY_NORMAL,         ///< Default time-sharing priority
+        THREAD_PRIORITY_HIGH,           ///< Time-sharing with a raised nice value, still shares the CPU fairly
+        THREAD_PRIORITY_REALTIME,       ///< Real-time FIFO, preempts nearly everything including kernel work
+};
+
+/**
+ * Placement of one logical CPU
+ */
+typedef struct cpu_info {
+        int id;         ///< Logical CPU number used by the OS
+        int core;       ///< Index of the physical core, from 0 to num_cores - 1
+        int smt;        ///< Index of this CPU among the SMT siblings of its core
+        int package;    ///< Physical package (socket) ID reported by the OS
+        int l3;         ///< Index of the group of CPUs sharing an L3 cache
+        int node;       ///< NUMA node ID
+} cpu_info_t;
+
+/**
+ * CPU topology of the machine, detected once at startup
+ */
+typedef struct cpu_topology {
+        int num_cpus;           ///< Number of online logical CPUs
+        int num_cores;          ///< Number of physical cores
+        int num_l3;             ///< Number of L3 cache groups
+        int num_nodes;          ///< Number of NUMA nodes
+        const cpu_info_t *cpus; ///< Online CPUs, sorted by id
+} cpu_topology_t;
+
+/**
+ * Opaque mutex handle, created by rune_mutex_new
+ */
+typedef struct rune_mutex rune_mutex_t;
+
+/**
+ * Opaque condition variable handle, created by rune_cond_new
+ */
+typedef struct rune_cond rune_cond_t;
+
+/**
+ * Opaque reader-writer lock handle, created by rune_rwlock_new
+ */
+typedef struct rune_rwlock rune_rwlock_t;
+
+/**
+ * Opaque counting semaphore handle, created by rune_sem_new
+ */
+typedef struct rune_sem rune_sem_t;
+
+/**
+ * Opaque one-shot event handle, created by rune_event_new
+ */
+typedef struct rune_event rune_event_t;
+
+/**
+ * Opaque thread barrier handle, created by rune_barrier_new
+ */
+typedef struct rune_barrier rune_barrier_t;
+
+/**
+ * Function executed by a job
+ */
+typedef void (*job_fn_t)(void *data);
+
+/**
+ * Description of a job passed to rune_job_run
+ */
+typedef struct job_decl {
+        job_fn_t fn;            ///< Function to execute
+        void *data;             ///< Argument passed to fn
+} job_decl_t;
+
+/**
+ * Counts unfinished jobs, must be zero-initialized before first use
+ */
+typedef struct job_counter {
+        atomic_int value;       ///< Number of jobs that have not finished yet
+        void *waiters;          ///< Fibers suspended on the counter, used internally
+} job_counter_t;
 
 /**
  * \brief Initializes the engine's thread API, must be called before using any
@@ -50,6 +127,14 @@ typedef struct mutex {
  */
 RAPI void rune_init_thread_api(void);
 
+/**
+ * \brief Releases the thread API's pools and mutex IDs, called by rune_exit
+ *
+ * Every thread other than the caller must have exited, and mutexes and
+ * thread IDs from before the call are no longer valid afterwards.
+ */
+RAPI void rune_close_thread_api(void);
+
 /**
  * \brief Creates and starts a new thread
  * \param[in] thread_fn The function the thread will execute
@@ -74,19 +159,128 @@ RAPI int rune_thread_cancel(int ID);
 RAPI int rune_thread_join(int ID, void **retval);
 
 /**
- * \brief Gets the current thread ID
+ * \brief Gets the current thread ID in constant time
  * \return Current in-engine ID of the calling thread, or -1 on error
  */
 RAPI int rune_thread_self(void);
 
+/**
+ * \brief Gets the handle of the current thread
+ * \return Handle of the calling thread, or NULL if it was not created by the
+ * thread API
+ */
+RAPI thread_t* rune_thread_current(void);
+
 /**
  * \brief Terminates the calling thread
  * \param[in] retval Where to put the thread_fn return value
  */
 RAPI void rune_thread_exit(void *retval);
 
+/**
+ * \brief Gets the CPU topology of the machine
+ * Parsed from /sys/devices/system/cpu on first use. On other platforms, or if
+ * sysfs is unavailable, every online CPU is reported as its own core.
+ * \return Topology description, valid for the lifetime of the program
+ */
+RAPI const cpu_topology_t* rune_cpu_topology(void);
+
+/**
+ * \brief Restricts a thread to a set of logical CPUs
+ * \param[in] ID Thread to pin
+ * \param[in] cpus Array of logical CPU numbers, see cpu_info_t.id
+ * \param[in] count Number of entries in cpus, or 0 to allow every CPU
+ * \return 0, or -1 if the thread does not exist or the call failed
+ */
+RAPI int rune_thread_set_affinity(int ID, const int *cpus, int count);
+
+/**
+ * \brief Changes the scheduling priority of a thread
+ * Raising a thread above normal can need the RLIMIT_NICE limit or
+ * elevated privileges, and THREAD_PRIORITY_REALTIME usually needs them.
+ * \param[in] ID Thread to change
+ * \param[in] priority One of enum thread_priority
+ * \return 0, or -1 if the thread does not exist or the call failed
+ */
+RAPI int rune_thread_set_priority(int ID, int priority);
+
+/**
+ * \brief Names a thread for debuggers and system tools
+ * \param[in] ID Thread to name
+ * \param[in] name New name, truncated to 15 characters
+ * \return 0, or -1 if the thread does not exist or the call failed
+ */
+RAPI int rune_thread_set_name(int ID, const char *name);
+
+/**
+ * \brief Reserves a thread-local storage slot
+ * Every thread sees its own value in the slot, initially NULL.
+ * \param[in] destructor Called with the thread's value, if not NULL, when a
+ * thread created by rune_thread_init exits. May be NULL.
+ * \return Slot index, or -1 if all slots are in use
+ */
+RAPI int rune_tls_alloc(void (*destructor)(void *value));
+
+/**
+ * \brief Releases a thread-local storage slot
+ * Values still stored in the slot are forgotten without calling the
+ * destructor.
+ * \param[in] slot Slot returned by rune_tls_alloc
+ */
+RAPI void rune_tls_free(int slot);
+
+/**
+ * \brief Sets the calling thread's value in a slot
+ * \param[in] slot Slot returned by rune_tls_alloc
+ * \param[in] value New value
+ * \return 0, or -1 if the slot is not allocated
+ */
+RAPI int rune_tls_set(int slot, void *value);
+
+/**
+ * \brief Gets the calling thread's value in a slot
+ * \param[in] slot Slot returned by rune_tls_alloc
+ * \return The value, or NULL if none was set
+ */
+RAPI void* rune_tls_get(int slot);
+
 /**
  * \brief Creates a new mutex
+ * Uncontended locking is a single atomic operation. Contended lockers spin
+ * for a while, adapting the spin count to how long the lock is usually held,
+ * and then sleep in the kernel until the mutex is released.
+ * \return Handle to the new mutex, or NULL on error
+ */
+RAPI rune_mutex_t* rune_mutex_new(void);
+
+/**
+ * \brief Destroys a mutex, which must not be locked
+ * \param[in] mutex Mutex created by rune_mutex_new, or NULL
+ */
+RAPI void rune_mutex_free(rune_mutex_t *mutex);
+
+/**
+ * \brief Locks a mutex, waiting until it is available
+ * \param[in] mutex Mutex to lock
+ */
+RAPI void rune_mutex_acquire(rune_mutex_t *mutex);
+
+/**
+ * \brief Locks a mutex only if it is available
+ * \param[in] mutex Mutex to lock
+ * \return 0 if the mutex was locked, -1 if it is held by another thread
+ */
+RAPI int rune_mutex_try_acquire(rune_mutex_t *mutex);
+
+/**
+ * \brief Unlocks a mutex held by the calling thread
+ * \param[in] mutex Mutex to unlock
+ */
+RAPI void rune_mutex_release(rune_mutex_t *mutex);
+
+/**
+ * \brief Creates a new mutex identified by an integer
+ * Compatibility wrapper around rune_mutex_new; new code should use handles.
  * \return ID of new mutex, or -1 on error
  */
 RAPI int rune_mutex_init(void);
@@ -94,19 +288,276 @@ RAPI int rune_mutex_init(void);
 /**
  * \brief Cleans up a mutex and releases its memory
  * \param[in] ID Mutex to destroy
+ * \return 0, or -1 if the mutex does not exist
  */
 RAPI int rune_mutex_destroy(int ID);
 
 /**
  * \brief Locks a mutex
  * \param[in] ID Mutex to lock
+ * \return 0, or -1 if the mutex does not exist
  */
 RAPI int rune_mutex_lock(int ID);
 
 /**
  * \brief Unlocks a mutex
  * \param[in] ID Mutex to unlock
+ * \return 0, or -1 if the mutex does not exist
  */
 RAPI int rune_mutex_unlock(int ID);
 
+/**
+ * \brief Creates a new condition variable
+ * \return Handle to the new condition variable, or NULL on error
+ */
+RAPI rune_cond_t* rune_cond_new(void);
+
+/**
+ * \brief Destroys a condition variable, which must have no waiters
+ * \param[in] cond Condition variable created by rune_cond_new, or NULL
+ */
+RAPI void rune_cond_free(rune_cond_t *cond);
+
+/**
+ * \brief Atomically unlocks a mutex and waits to be signaled
+ * The mutex is locked again before this function returns. Wakeups may be
+ * spurious, so callers must recheck their condition in a loop.
+ * \param[in] cond Condition variable to wait on
+ * \param[in] mutex Mutex held by the calling thread
+ */
+RAPI void rune_cond_wait(rune_cond_t *cond, rune_mutex_t *mutex);
+
+/**
+ * \brief Like rune_cond_wait, but gives up after a timeout
+ * \param[in] cond Condition variable to wait on
+ * \param[in] mutex Mutex held by the calling thread
+ * \param[in] timeout_ns Maximum time to wait in nanoseconds
+ * \return 0 if woken, -1 if the timeout expired
+ */
+RAPI int rune_cond_wait_timeout(rune_cond_t *cond, rune_mutex_t *mutex, int64_t timeout_ns);
+
+/**
+ * \brief Wakes one thread waiting on a condition variable
+ * Does not enter the kernel when nobody is waiting.
+ * \param[in] cond Condition variable to signal
+ */
+RAPI void rune_cond_signal(rune_cond_t *cond);
+
+/**
+ * \brief Wakes every thread waiting on a condition variable
+ * \param[in] cond Condition variable to signal
+ */
+RAPI void rune_cond_broadcast(rune_cond_t *cond);
+
+/**
+ * \brief Creates a new reader-writer lock
+ * Any number of readers may hold the lock at once, or a single writer.
+ * Waiting writers take priority over new readers, so read locks must not be
+ * taken recursively.
+ * \return Handle to the new lock, or NULL on error
+ */
+RAPI rune_rwlock_t* rune_rwlock_new(void);
+
+/**
+ * \brief Destroys a reader-writer lock, which must not be held
+ * \param[in] lock Lock created by rune_rwlock_new, or NULL
+ */
+RAPI void rune_rwlock_free(rune_rwlock_t *lock);
+
+/**
+ * \brief Takes a shared read lock, waiting while a writer holds or wants it
+ * \param[in] lock Lock to take
+ */
+RAPI void rune_rwlock_read_acquire(rune_rwlock_t *lock);
+
+/**
+ * \brief Takes a shared read lock only if no writer holds or wants it
+ * \param[in] lock Lock to take
+ * \return 0 if the lock was taken, -1 otherwise
+ */
+RAPI int rune_rwlock_try_read_acquire(rune_rwlock_t *lock);
+
+/**
+ * \brief Releases a read lock held by the calling thread
+ * \param[in] lock Lock to release
+ */
+RAPI void rune_rwlock_read_release(rune_rwlock_t *lock);
+
+/**
+ * \brief Takes the exclusive write lock, waiting for all holders to leave
+ * \param[in] lock Lock to take
+ */
+RAPI void rune_rwlock_write_acquire(rune_rwlock_t *lock);
+
+/**
+ * \brief Takes the exclusive write lock only if nobody holds the lock
+ * \param[in] lock Lock to take
+ * \return 0 if the lock was taken, -1 otherwise
+ */
+RAPI int rune_rwlock_try_write_acquire(rune_rwlock_t *lock);
+
+/**
+ * \brief Releases the write lock held by the calling thread
+ * \param[in] lock Lock to release
+ */
+RAPI void rune_rwlock_write_release(rune_rwlock_t *lock);
+
+/**
+ * \brief Creates a new counting semaphore
+ * \param[in] initial Starting count, must not be negative
+ * \return Handle to the new semaphore, or NULL on error
+ */
+RAPI rune_sem_t* rune_sem_new(int initial);
+
+/**
+ * \brief Destroys a semaphore, which must have no waiters
+ * \param[in] sem Semaphore created by rune_sem_new, or NULL
+ */
+RAPI void rune_sem_free(rune_sem_t *sem);
+
+/**
+ * \brief Decrements a semaphore, waiting while its count is zero
+ * \param[in] sem Semaphore to decrement
+ */
+RAPI void rune_sem_wait(rune_sem_t *sem);
+
+/**
+ * \brief Decrements a semaphore only if its count is above zero
+ * \param[in] sem Semaphore to decrement
+ * \return 0 if the count was decremented, -1 otherwise
+ */
+RAPI int rune_sem_try_wait(rune_sem_t *sem);
+
+/**
+ * \brief Like rune_sem_wait, but gives up after a timeout
+ * \param[in] sem Semaphore to decrement
+ * \param[in] timeout_ns Maximum time to wait in nanoseconds
+ * \return 0 if the count was decremented, -1 if the timeout expired
+ */
+RAPI int rune_sem_wait_timeout(rune_sem_t *sem, int64_t timeout_ns);
+
+/**
+ * \brief Increments a semaphore, waking up to count waiting threads
+ * \param[in] sem Semaphore to increment
+ * \param[in] count Amount to add to the count
+ */
+RAPI void rune_sem_post(rune_sem_t *sem, int count);
+
+/**
+ * \brief Creates a new event in the unset state
+ * \return Handle to the new event, or NULL on error
+ */
+RAPI rune_event_t* rune_event_new(void);
+
+/**
+ * \brief Destroys an event, which must have no waiters
+ * \param[in] event Event created by rune_event_new, or NULL
+ */
+RAPI void rune_event_free(rune_event_t *event);
+
+/**
+ * \brief Sets an event, releasing all current and future waiters
+ * The event stays set until rune_event_reset is called.
+ * \param[in] event Event to set
+ */
+RAPI void rune_event_set(rune_event_t *event);
+
+/**
+ * \brief Returns an event to the unset state so it can be reused
+ * \param[in] event Event to reset, must have no waiters
+ */
+RAPI void rune_event_reset(rune_event_t *event);
+
+/**
+ * \brief Checks whether an event is set without waiting
+ * \param[in] event Event to check
+ * \return 1 if set, 0 otherwise
+ */
+RAPI int rune_event_is_set(rune_event_t *event);
+
+/**
+ * \brief Waits until an event is set
+ * \param[in] event Event to wait on
+ */
+RAPI void rune_event_wait(rune_event_t *event);
+
+/**
+ * \brief Like rune_event_wait, but gives up after a timeout
+ * \param[in] event Event to wait on
+ * \param[in] timeout_ns Maximum time to wait in nanoseconds
+ * \return 0 if the event was set, -1 if the timeout expired
+ */
+RAPI int rune_event_wait_timeout(rune_event_t *event, int64_t timeout_ns);
+
+/**
+ * \brief Creates a barrier for a fixed number of threads
+ * The barrier resets itself once every thread has arrived, so the same
+ * barrier can separate consecutive frames.
+ * \param[in] count Number of threads that must arrive, at least 1
+ * \return Handle to the new barrier, or NULL on error
+ */
+RAPI rune_barrier_t* rune_barrier_new(int count);
+
+/**
+ * \brief Destroys a barrier, which must have no waiters
+ * \param[in] barrier Barrier created by rune_barrier_new, or NULL
+ */
+RAPI void rune_barrier_free(rune_barrier_t *barrier);
+
+/**
+ * \brief Waits until every participating thread has reached the barrier
+ * \param[in] barrier Barrier to wait on
+ * \return 1 in exactly one thread per cycle, 0 in the others
+ */
+RAPI int rune_barrier_wait(rune_barrier_t *barrier);
+
+/**
+ * \brief Starts the job system
+ * The calling thread becomes worker 0 and keeps running its own code; it
+ * only executes jobs while waiting in rune_job_wait. The remaining workers
+ * run on their own threads. When there are no more workers than physical
+ * cores, worker N is pinned to the SMT siblings of core N, leaving the
+ * calling thread's affinity untouched.
+ * \param[in] num_workers Total number of workers including the calling
+ * thread, or 0 for one per physical core
+ * \return 0, or -1 on error
+ */
+RAPI int rune_job_init(int num_workers);
+
+/**
+ * \brief Stops all worker threads
+ * Every job must have finished before this is called.
+ */
+RAPI void rune_job_close(void);
+
+/**
+ * \brief Queues jobs for execution on any worker
+ * Jobs queued from a worker go on that worker's own deque and are stolen by
+ * idle workers; jobs queued from any other thread go through a shared queue.
+ * When the job system is not running, or a queue is full, jobs run
+ * immediately on the calling thread.
+ * \param[in] jobs Array of jobs to run, copied before this function returns
+ * \param[in] count Number of jobs in the array
+ * \param[in] counter Incremented by count, then decremented as each job
+ * finishes, or NULL
+ */
+RAPI void rune_job_run(const job_decl_t *jobs, int count, job_counter_t *counter);
+
+/**
+ * \brief Waits until a counter drops to zero, running other jobs meanwhile
+ * \param[in] counter Counter passed to rune_job_run
+ */
+RAPI void rune_job_wait(job_counter_t *counter);
+
+/**
+ * \brief Returns the number of workers, or 0 if the job system is not running
+ */
+RAPI int rune_job_num_workers(void);
+
+/**
+ * \brief Returns the index of the calling worker, or -1 if the calling thread
+ * is not a worker
+ */
+RAPI int rune_job_worker_index(void);
+
 #endif
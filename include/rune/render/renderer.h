@@ -24,14 +24,76 @@
 
 #include <rune/util/types.h>
 #include <rune/ui/window.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Everything the renderer needs to draw one frame, filled by game code
+ */
+typedef struct render_packet {
+        uint64_t frame;         ///< Number of the simulation frame that produced the packet, also selects its frame arena
+        float time;             ///< Simulation time of the frame, in seconds
+        void *data;             ///< Packet contents, carved up by rune_render_packet_alloc
+        size_t size;            ///< Bytes of data in use
+        size_t capacity;        ///< Bytes available at data
+} render_packet_t;
 
 typedef struct rune_renderer {
         void (*close)(void);
         void (*draw)(void);
         void (*clear)(void);
+        void (*draw_packet)(const render_packet_t *packet); ///< Records and submits one frame packet
 } renderer_t;
 
 RAPI renderer_t* select_render_vulkan(window_t *window);
 RAPI renderer_t* select_render_directx(window_t *window);
 
+/**
+ * \brief Sets up frame packets, optionally with a dedicated render thread
+ * Game code fills packets from rune_render_acquire_packet and hands them
+ * over with rune_render_submit_packet. With a render thread, two packets are
+ * in flight, so simulation of frame N+1 overlaps with recording and
+ * submission of frame N. Renderer functions must then not be called from
+ * any other thread until rune_render_pipeline_close returns.
+ * \param[in] renderer Renderer whose draw_packet hook consumes packets
+ * \param[in] packet_size Bytes of data available in each packet
+ * \param[in] threaded Nonzero to draw on a render thread, 0 to draw on the
+ * submitting thread
+ * \return 0, or -1 on error
+ */
+RAPI int rune_render_pipeline_init(renderer_t *renderer, size_t packet_size, int threaded);
+
+/**
+ * \brief Draws every submitted packet, stops the render thread and frees
+ * the packets
+ * Must be called from the thread that submits packets, before the renderer
+ * is closed.
+ */
+RAPI void rune_render_pipeline_close(void);
+
+/**
+ * \brief Gets an empty packet to fill for the next frame
+ * With a render thread, waits while both packets are still queued or being
+ * drawn.
+ * \return Packet with size reset to zero, or NULL if the pipeline has not
+ * been set up
+ */
+RAPI render_packet_t* rune_render_acquire_packet(void);
+
+/**
+ * \brief Hands a filled packet to the renderer
+ * With a render thread the packet is queued and this returns immediately;
+ * otherwise the packet is drawn on the calling thread.
+ * \param[in] packet Packet returned by rune_render_acquire_packet
+ */
+RAPI void rune_render_submit_packet(render_packet_t *packet);
+
+/**
+ * \brief Reserves space in a packet, aligned to 16 bytes
+ * \param[in] packet Packet being filled
+ * \param[in] sz Number of bytes to reserve
+ * \return Pointer into the packet data, or NULL if the packet is full
+ */
+RAPI void* rune_render_packet_alloc(render_packet_t *packet, size_t sz);
+
 #endif
@@ -24,10 +24,14 @@
 
 #include <rune/core/abort.h>
 #include <rune/core/alloc.h>
+#include <rune/core/binlog.h>
 #include <rune/core/callbacks.h>
+#include <rune/core/fiber.h>
 #include <rune/core/init.h>
 #include <rune/core/logging.h>
 #include <rune/core/mod.h>
+#include <rune/core/parallel.h>
+#include <rune/core/taskgraph.h>
 #include <rune/core/thread.h>
 
 #include <rune/ui/input.h>
@@ -38,6 +42,7 @@
 
 #include <rune/util/exits.h>
 #include <rune/util/list.h>
+#include <rune/util/queue.h>
 #include <rune/util/types.h>
 
 #endif
@@ -47,6 +47,19 @@ static inline void list_add(list_head_t *new, list_head_t *head) {
         new->next = NULL;
 }
 
+/**
+ * \brief Insert element directly after another element, in constant time
+ * \param[in] new Pointer to list_head_t, part of another struct
+ * \param[in] head Element to insert after, usually the start of the list
+ */
+static inline void list_insert(list_head_t *new, list_head_t *head) {
+        new->next = head->next;
+        new->prev = head;
+        if (head->next != NULL)
+                head->next->prev = new;
+        head->next = new;
+}
+
 /**
  * \brief Remove element from a list
  * \param[in] item Pointer to list_head_t, part of another struct
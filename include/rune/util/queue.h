@@ -0,0 +1,338 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef RUNE_UTIL_QUEUE_H
+#define RUNE_UTIL_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Lock-free queues for handing data between threads
+ *
+ * The ring queues are bounded and copy fixed-size elements in and out of a
+ * caller-provided buffer, so they can sit in static storage or in memory from
+ * any allocator. Capacities must be a power of two. The MPSC queue is
+ * intrusive and unbounded: embed an mpsc_node_t in the struct being queued and
+ * recover the container after popping.
+ */
+
+/// Size of a cache line, used to keep producer and consumer indices apart
+#define QUEUE_CACHE_LINE 64
+
+/**
+ * Bounded single-producer, single-consumer ring queue
+ */
+typedef struct spsc_queue {
+        _Alignas(QUEUE_CACHE_LINE) atomic_size_t head;  ///< Next slot to pop, written by the consumer
+        size_t cached_tail;                             ///< Consumer's last view of tail
+        _Alignas(QUEUE_CACHE_LINE) atomic_size_t tail;  ///< Next slot to push, written by the producer
+        size_t cached_head;                             ///< Producer's last view of head
+        _Alignas(QUEUE_CACHE_LINE) size_t mask;         ///< Capacity minus one
+        size_t elem_size;                               ///< Size of one element in bytes
+        uint8_t *buffer;                                ///< Element storage, capacity * elem_size bytes
+} spsc_queue_t;
+
+/**
+ * \brief Initialize an SPSC queue over a caller-provided buffer
+ * \param[out] q Queue to initialize
+ * \param[in] buffer Storage of at least capacity * elem_size bytes
+ * \param[in] capacity Number of elements, must be a power of two
+ * \param[in] elem_size Size of one element in bytes
+ * \return 0 on success, -1 if capacity is not a power of two
+ */
+static inline int spsc_queue_init(spsc_queue_t *q, void *buffer, size_t capacity, size_t elem_size) {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+                return -1;
+
+        atomic_init(&q->head, 0);
+        atomic_init(&q->tail, 0);
+        q->cached_head = 0;
+        q->cached_tail = 0;
+        q->mask = capacity - 1;
+        q->elem_size = elem_size;
+        q->buffer = buffer;
+        return 0;
+}
+
+/**
+ * \brief Push an element, must only be called from the producer thread
+ * \param[in] q Queue to push to
+ * \param[in] elem Pointer to elem_size bytes to copy in
+ * \return 0 on success, -1 if the queue is full
+ */
+static inline int spsc_queue_push(spsc_queue_t *q, const void *elem) {
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        if (tail - q->cached_head > q->mask) {
+                q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+                if (tail - q->cached_head > q->mask)
+                        return -1;
+        }
+
+        memcpy(q->buffer + (tail & q->mask) * q->elem_size, elem, q->elem_size);
+        atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+        return 0;
+}
+
+/**
+ * \brief Pop an element, must only be called from the consumer thread
+ * \param[in] q Queue to pop from
+ * \param[out] elem Pointer to elem_size bytes to copy out to
+ * \return 0 on success, -1 if the queue is empty
+ */
+static inline int spsc_queue_pop(spsc_queue_t *q, void *elem) {
+        size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        if (head == q->cached_tail) {
+                q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+                if (head == q->cached_tail)
+                        return -1;
+        }
+
+        memcpy(elem, q->buffer + (head & q->mask) * q->elem_size, q->elem_size);
+        atomic_store_explicit(&q->head, head + 1, memory_order_release);
+        return 0;
+}
+
+/**
+ * \brief Get an approximate count of queued elements
+ * \param[in] q Queue to inspect
+ * \return Number of elements, may be stale if other threads are active
+ */
+static inline size_t spsc_queue_size(spsc_queue_t *q) {
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+        return tail - head;
+}
+
+/**
+ * \brief Bytes of storage needed for one MPMC queue cell
+ * \param[in] elem_size Size of one element in bytes
+ */
+#define MPMC_QUEUE_CELL_SIZE(elem_size) \
+        ((sizeof(atomic_size_t) + (elem_size) + sizeof(atomic_size_t) - 1) \
+         & ~(sizeof(atomic_size_t) - 1))
+
+/**
+ * \brief Bytes of storage needed for an MPMC queue buffer
+ * \param[in] capacity Number of elements, must be a power of two
+ * \param[in] elem_size Size of one element in bytes
+ */
+#define MPMC_QUEUE_BUFFER_SIZE(capacity, elem_size) \
+        ((capacity) * MPMC_QUEUE_CELL_SIZE(elem_size))
+
+/**
+ * Bounded multi-producer, multi-consumer ring queue
+ *
+ * Each cell carries a sequence number that tells producers and consumers
+ * whether it is free for the current lap, so a push or pop costs one CAS on
+ * the shared index in the common case.
+ */
+typedef struct mpmc_queue {
+        _Alignas(QUEUE_CACHE_LINE) atomic_size_t head;  ///< Next position to pop
+        _Alignas(QUEUE_CACHE_LINE) atomic_size_t tail;  ///< Next position to push
+        _Alignas(QUEUE_CACHE_LINE) size_t mask;         ///< Capacity minus one
+        size_t elem_size;                               ///< Size of one element in bytes
+        size_t cell_size;                               ///< Stride of one cell in the buffer
+        uint8_t *buffer;                                ///< Cell storage, see MPMC_QUEUE_BUFFER_SIZE
+} mpmc_queue_t;
+
+static inline atomic_size_t* _mpmc_cell_seq(mpmc_queue_t *q, size_t pos) {
+        return (atomic_size_t*)(q->buffer + (pos & q->mask) * q->cell_size);
+}
+
+/**
+ * \brief Initialize an MPMC queue over a caller-provided buffer
+ * \param[out] q Queue to initialize
+ * \param[in] buffer Storage of at least MPMC_QUEUE_BUFFER_SIZE(capacity, elem_size)
+ *            bytes, aligned for atomic_size_t
+ * \param[in] capacity Number of elements, must be a power of two
+ * \param[in] elem_size Size of one element in bytes
+ * \return 0 on success, -1 if capacity is not a power of two
+ */
+static inline int mpmc_queue_init(mpmc_queue_t *q, void *buffer, size_t capacity, size_t elem_size) {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+                return -1;
+
+        q->mask = capacity - 1;
+        q->elem_size = elem_size;
+        q->cell_size = MPMC_QUEUE_CELL_SIZE(elem_size);
+        q->buffer = buffer;
+        for (size_t i = 0; i < capacity; i++)
+                atomic_init(_mpmc_cell_seq(q, i), i);
+        atomic_init(&q->head, 0);
+        atomic_init(&q->tail, 0);
+        return 0;
+}
+
+/**
+ * \brief Push an element, safe from any number of threads
+ * \param[in] q Queue to push to
+ * \param[in] elem Pointer to elem_size bytes to copy in
+ * \return 0 on success, -1 if the queue is full
+ */
+static inline int mpmc_queue_push(mpmc_queue_t *q, const void *elem) {
+        size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        atomic_size_t *seq;
+        for (;;) {
+                seq = _mpmc_cell_seq(q, pos);
+                size_t s = atomic_load_explicit(seq, memory_order_acquire);
+                intptr_t diff = (intptr_t)s - (intptr_t)pos;
+                if (diff == 0) {
+                        if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+                                break;
+                } else if (diff < 0) {
+                        return -1;
+                } else {
+                        pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+                }
+        }
+
+        memcpy((uint8_t*)seq + sizeof(atomic_size_t), elem, q->elem_size);
+        atomic_store_explicit(seq, pos + 1, memory_order_release);
+        return 0;
+}
+
+/**
+ * \brief Pop an element, safe from any number of threads
+ * \param[in] q Queue to pop from
+ * \param[out] elem Pointer to elem_size bytes to copy out to
+ * \return 0 on success, -1 if the queue is empty
+ */
+static inline int mpmc_queue_pop(mpmc_queue_t *q, void *elem) {
+        size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        atomic_size_t *seq;
+        for (;;) {
+                seq = _mpmc_cell_seq(q, pos);
+                size_t s = atomic_load_explicit(seq, memory_order_acquire);
+                intptr_t diff = (intptr_t)s - (intptr_t)(pos + 1);
+                if (diff == 0) {
+                        if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+                                break;
+                } else if (diff < 0) {
+                        return -1;
+                } else {
+                        pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+                }
+        }
+
+        memcpy(elem, (uint8_t*)seq + sizeof(atomic_size_t), q->elem_size);
+        atomic_store_explicit(seq, pos + q->mask + 1, memory_order_release);
+        return 0;
+}
+
+/**
+ * Link embedded in structs queued on an mpsc_queue_t
+ */
+typedef struct mpsc_node {
+        struct mpsc_node *_Atomic next; ///< Next node toward the producers
+} mpsc_node_t;
+
+/**
+ * Unbounded intrusive multi-producer, single-consumer queue
+ *
+ * Producers never block or fail. The consumer may briefly see the queue as
+ * empty while a producer is between its two steps of a push; it should simply
+ * retry later.
+ */
+typedef struct mpsc_queue {
+        _Alignas(QUEUE_CACHE_LINE) mpsc_node_t *_Atomic head;   ///< Most recently pushed node
+        _Alignas(QUEUE_CACHE_LINE) mpsc_node_t *tail;           ///< Oldest node, owned by the consumer
+        mpsc_node_t stub;                                       ///< Placeholder that keeps the list non-empty
+} mpsc_queue_t;
+
+/**
+ * \brief Initialize an empty MPSC queue
+ * \param[out] q Queue to initialize
+ */
+static inline void mpsc_queue_init(mpsc_queue_t *q) {
+        atomic_init(&q->stub.next, NULL);
+        atomic_init(&q->head, &q->stub);
+        q->tail = &q->stub;
+}
+
+/**
+ * \brief Push a node, safe from any number of threads
+ * \param[in] q Queue to push to
+ * \param[in] node Node embedded in the item being queued
+ */
+static inline void mpsc_queue_push(mpsc_queue_t *q, mpsc_node_t *node) {
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        mpsc_node_t *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+        atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/**
+ * \brief Pop the oldest node, must only be called from the consumer thread
+ * \param[in] q Queue to pop from
+ * \return The popped node, or NULL if the queue is empty or a push is in flight
+ */
+static inline mpsc_node_t* mpsc_queue_pop(mpsc_queue_t *q) {
+        mpsc_node_t *tail = q->tail;
+        mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (tail == &q->stub) {
+                if (next == NULL)
+                        return NULL;
+                q->tail = next;
+                tail = next;
+                next = atomic_load_explicit(&next->next, memory_order_acquire);
+        }
+
+        if (next != NULL) {
+                q->tail = next;
+                return tail;
+        }
+
+        if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+                return NULL;
+
+        mpsc_queue_push(q, &q->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (next != NULL) {
+                q->tail = next;
+                return tail;
+        }
+        return NULL;
+}
+
+/**
+ * \brief Check whether an MPSC queue has no nodes, from the consumer thread
+ * \param[in] q Queue to inspect
+ * \return 1 if empty, 0 otherwise
+ */
+static inline int mpsc_queue_empty(mpsc_queue_t *q) {
+        return q->tail == &q->stub
+                && atomic_load_explicit(&q->stub.next, memory_order_acquire) == NULL;
+}
+
+/**
+ * \brief Get the struct containing an embedded queue node
+ * \param[in] ptr Pointer to the mpsc_node_t member
+ * \param[in] type Type of the containing struct
+ * \param[in] member Name of the mpsc_node_t member within type
+ */
+#define mpsc_entry(ptr, type, member) \
+        ((type*)((uint8_t*)(ptr) - offsetof(type, member)))
+
+#endif
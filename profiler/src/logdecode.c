@@ -0,0 +1,289 @@
+/*
+ * Rune Game Engine
+ * Copyright 2024 Danny Holman <dholman@gymli.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Turns a binary log written by rune_binlog_start back into text. Each
+ * conversion in a format string is printed with snprintf on its own,
+ * using the argument bytes recorded for it. Integers are always stored as
+ * 64 bits, so the length modifier is replaced with ll. Threads flush their
+ * records in chunks, so messages are sorted by timestamp before printing.
+ */
+
+#include <rune/core/binlog.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FORMATS     65536
+#define SPEC_LEN        64
+
+struct format {
+        const char *fmt;
+        int level;
+};
+
+struct message {
+        binlog_record_t rec;
+        size_t offset;
+};
+
+struct reader {
+        const unsigned char *pos;
+        const unsigned char *end;
+};
+
+static const char *level_names[] = {
+        "[FATAL]", "[ERROR]", "[WARNING]", "[INFO]", "[DEBUG]"
+};
+
+static int _read_int(struct reader *r, int64_t *out) {
+        if (r->end - r->pos < (ptrdiff_t)sizeof(*out))
+                return -1;
+        memcpy(out, r->pos, sizeof(*out));
+        r->pos += sizeof(*out);
+        return 0;
+}
+
+static int _read_string(struct reader *r, char *out) {
+        uint16_t len;
+        if (r->end - r->pos < (ptrdiff_t)sizeof(len))
+                return -1;
+        memcpy(&len, r->pos, sizeof(len));
+        r->pos += sizeof(len);
+        if (len > BINLOG_MAX_STRING || r->end - r->pos < len)
+                return -1;
+        memcpy(out, r->pos, len);
+        out[len] = '\0';
+        r->pos += len;
+        return 0;
+}
+
+static int _print_message(const char *fmt, struct reader *r) {
+        char spec[SPEC_LEN];
+        char str[BINLOG_MAX_STRING + 1];
+        int64_t val;
+        double dval;
+        const char *c = fmt;
+        while (*c != '\0') {
+                if (*c != '%') {
+                        putchar(*c++);
+                        continue;
+                }
+                c++;
+                if (*c == '%') {
+                        putchar(*c++);
+                        continue;
+                }
+
+                int n = 0;
+                spec[n++] = '%';
+                while (*c != '\0' && strchr("-+ #0'", *c) != NULL && n < SPEC_LEN - 32)
+                        spec[n++] = *c++;
+                for (int part = 0; part < 2; part++) {
+                        if (*c == '*') {
+                                if (_read_int(r, &val) != 0 || val < INT_MIN || val > INT_MAX)
+                                        return -1;
+                                if (part == 0 || val >= 0)
+                                        n += snprintf(spec + n, SPEC_LEN - n, "%s%lld", part == 1 ? "." : "", (long long)val);
+                                if (n > SPEC_LEN - 8)
+                                        n = SPEC_LEN - 8;
+                                c++;
+                        } else {
+                                if (part == 1)
+                                        spec[n++] = '.';
+                                while (*c >= '0' && *c <= '9' && n < SPEC_LEN - 8)
+                                        spec[n++] = *c++;
+                        }
+                        if (part == 0 && *c == '.')
+                                c++;
+                        else
+                                break;
+                }
+                while (*c != '\0' && strchr("hljzt", *c) != NULL)
+                        c++;
+
+                char conv = *c++;
+                switch (conv) {
+                        case 'd':
+                        case 'i':
+                        case 'o':
+                        case 'u':
+                        case 'x':
+                        case 'X':
+                                if (_read_int(r, &val) != 0)
+                                        return -1;
+                                snprintf(spec + n, SPEC_LEN - n, "ll%c", conv);
+                                if (conv == 'd' || conv == 'i')
+                                        printf(spec, (long long)val);
+                                else
+                                        printf(spec, (unsigned long long)val);
+                                break;
+                        case 'c':
+                                if (_read_int(r, &val) != 0)
+                                        return -1;
+                                snprintf(spec + n, SPEC_LEN - n, "c");
+                                printf(spec, (int)val);
+                                break;
+                        case 'p':
+                                if (_read_int(r, &val) != 0)
+                                        return -1;
+                                snprintf(spec + n, SPEC_LEN - n, "p");
+                                printf(spec, (void*)(uintptr_t)val);
+                                break;
+                        case 's':
+                                if (_read_string(r, str) != 0)
+                                        return -1;
+                                snprintf(spec + n, SPEC_LEN - n, "s");
+                                printf(spec, str);
+                                break;
+                        case 'a':
+                        case 'A':
+                        case 'e':
+                        case 'E':
+                        case 'f':
+                        case 'F':
+                        case 'g':
+                        case 'G':
+                                if (_read_int(r, &val) != 0)
+                                        return -1;
+                                memcpy(&dval, &val, sizeof(dval));
+                                snprintf(spec + n, SPEC_LEN - n, "%c", conv);
+                                printf(spec, dval);
+                                break;
+                        default:
+                                return -1;
+                }
+        }
+        return 0;
+}
+
+static int _compare_messages(const void *a, const void *b) {
+        const struct message *x = a;
+        const struct message *y = b;
+        if (x->rec.timestamp != y->rec.timestamp)
+                return x->rec.timestamp < y->rec.timestamp ? -1 : 1;
+        return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static unsigned char* _load_file(const char *path, size_t *size) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+                fprintf(stderr, "Cannot open %s\n", path);
+                return NULL;
+        }
+
+        fseek(file, 0, SEEK_END);
+        long len = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        unsigned char *data = len > 0 ? malloc(len) : NULL;
+        if (data == NULL || fread(data, len, 1, file) != 1) {
+                fprintf(stderr, "Cannot read %s\n", path);
+                free(data);
+                fclose(file);
+                return NULL;
+        }
+        fclose(file);
+        *size = len;
+        return data;
+}
+
+int main(int argc, char **argv) {
+        if (argc < 2) {
+                fprintf(stderr, "Usage: %s <binary log>\n", argv[0]);
+                return 1;
+        }
+
+        size_t size;
+        unsigned char *data = _load_file(argv[1], &size);
+        if (data == NULL)
+                return 1;
+
+        binlog_header_t header;
+        memcpy(&header, data, size < sizeof(header) ? size : sizeof(header));
+        if (size < sizeof(header) || header.magic != BINLOG_MAGIC || header.version != BINLOG_VERSION
+                        || header.record_size != sizeof(binlog_record_t)) {
+                fprintf(stderr, "%s is not a binary log\n", argv[1]);
+                free(data);
+                return 1;
+        }
+
+        struct format *formats = calloc(MAX_FORMATS, sizeof(struct format));
+        struct message *messages = malloc((size / sizeof(binlog_record_t) + 1) * sizeof(struct message));
+        if (formats == NULL || messages == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+        }
+
+        size_t num_messages = 0;
+        size_t offset = sizeof(header);
+        binlog_record_t rec;
+        while (offset + sizeof(rec) <= size) {
+                memcpy(&rec, data + offset, sizeof(rec));
+                if (rec.size < sizeof(rec) || offset + rec.size > size) {
+                        fprintf(stderr, "Truncated record at offset %zu\n", offset);
+                        break;
+                }
+
+                if (rec.id == BINLOG_FORMAT_ID) {
+                        uint16_t def[2];
+                        const char *fmt = (const char*)data + offset + sizeof(rec) + sizeof(def);
+                        if (rec.size >= sizeof(rec) + sizeof(def)) {
+                                memcpy(def, data + offset + sizeof(rec), sizeof(def));
+                                if (memchr(fmt, '\0', rec.size - sizeof(rec) - sizeof(def)) != NULL) {
+                                        formats[def[0]].fmt = fmt;
+                                        formats[def[0]].level = def[1];
+                                }
+                        }
+                } else {
+                        messages[num_messages].rec = rec;
+                        messages[num_messages].offset = offset;
+                        num_messages++;
+                }
+                offset += rec.size;
+        }
+
+        qsort(messages, num_messages, sizeof(struct message), _compare_messages);
+        struct reader r;
+        struct format *format;
+        for (size_t i = 0; i < num_messages; i++) {
+                rec = messages[i].rec;
+                format = &formats[rec.id];
+                if (format->fmt == NULL) {
+                        fprintf(stderr, "Record at offset %zu uses undefined format %u\n",
+                                        messages[i].offset, rec.id);
+                        continue;
+                }
+
+                printf("[%12.6f] [T%u] %s ", rec.timestamp / 1e9, rec.thread,
+                                format->level <= LOG_DEBUG ? level_names[format->level] : "[?]");
+                r.pos = data + messages[i].offset + sizeof(rec);
+                r.end = data + messages[i].offset + rec.size;
+                if (_print_message(format->fmt, &r) != 0)
+                        printf(" <truncated arguments>");
+                putchar('\n');
+        }
+
+        free(messages);
+        free(formats);
+        free(data);
+        return 0;
+}
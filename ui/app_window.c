@@ -13,7 +13,7 @@ struct rune_window* rune_init_window(void) {
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
         glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-        struct rune_window *ret = rune_alloc(sizeof(struct rune_window));
+        struct rune_window *ret = rune_alloc_tagged(sizeof(struct rune_window), MEM_TAG_UI);
         ret->winw = 1920;
         ret->winh = 1080;
         ret->wintitle = rune_get_app_name();